@@ -0,0 +1,112 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <algorithm>
+#include <stdexcept>
+#include "FastMath.h"
+#include "Matrix.h"
+#include "Profiler.h"
+
+/**
+ * Static class with the activation functions of the layers of a NeuralNetwork.
+ * Works in place on a whole batch, one row per data point:
+ *
+ *      Apply        a = f(z + b) for every row z of the layer output, where b is the bias row
+ *      Derivative   delta = delta .* f'(z), computed from the cached activations a = f(z)
+ *
+ * The exponentials of sigmoid, tanh and softmax are computed a whole SIMD register
+ * at a time, see FastMath.h. The derivatives never call exp, they only need a:
+ * sigmoid' = a (1 - a), tanh' = 1 - a^2 and ReLU' = a > 0.
+ *
+ * The element-wise functions (all but softmax) can be applied to any part of a row,
+ * which lets the matrix multiplication apply them as its epilogue, to every tile of
+ * the output as soon as it is computed (see NeuralNetwork::fullForward).
+ *
+ * Softmax is only meant for the output layer, combined with the cross-entropy cost its
+ * derivative cancels out (see NeuralNetwork::costPrime) and Derivative does not support it.
+ *
+ * Example:
+ *
+ *      Z = A * W;                                   // layer output, rows x n
+ *      Activation::Apply(Activation::ReLU, b, Z);   // b is 1 x n, Z now holds the activations
+ *      Activation::Derivative(Activation::ReLU, Z, delta);
+ */
+class Activation {
+    Activation() {/* To prevent instantiation */}
+
+public:
+    enum Type { Sigmoid, ReLU, Tanh, Softmax };
+
+    /** True if f(x) only depends on x, i.e if Apply works on parts of rows. */
+    static bool ElementWise(Type type) { return type != Softmax; }
+
+    /**
+     * Applies the function to the n values of x, with bias[i] added to x[i] first.
+     * For softmax x has to be a whole row.
+     */
+    template <typename T>
+    static void Apply(Type type, const T *bias, T *x, size_t n) {
+        using S = Simd<T>;
+        switch (type) {
+            case Sigmoid:
+                FastMath<T>::apply(x, n, [](typename S::reg v){ return FastMath<T>::sigmoid(v); }, bias);
+                break;
+            case Tanh:
+                FastMath<T>::apply(x, n, [](typename S::reg v){ return FastMath<T>::tanh(v); }, bias);
+                break;
+            case ReLU:
+                for (size_t j = 0; j < n; ++j)
+                    x[j] = std::max(x[j] + bias[j], T());
+                break;
+            case Softmax: {
+                // shifted by the max of the row so exp never overflows
+                T max = x[0] + bias[0], sum = 0;
+                for (size_t j = 0; j < n; ++j)
+                    max = std::max(max, x[j] += bias[j]);
+                FastMath<T>::apply(x, n, [max](typename S::reg v){ return FastMath<T>::exp(S::sub(v, S::set1(max))); });
+                for (size_t j = 0; j < n; ++j)
+                    sum += x[j];
+                for (size_t j = 0; j < n; ++j)
+                    x[j] /= sum;
+                break;
+            }
+        }
+    }
+
+    template <typename T>
+    static void Apply(Type type, const Matrix<T> &bias, Matrix<T> &a) {
+        if (bias.rows() != 1 || bias.cols() != a.cols())
+            throw std::invalid_argument("Activation::Apply() - Bias does not match layer");
+        NN_PROFILE_SCOPE("activation");
+        for (size_t i = 0; i < a.rows(); ++i)
+            Apply(type, bias.begin(), a.begin(i), a.cols());
+    }
+
+    template <typename T>
+    static void Derivative(Type type, const Matrix<T> &a, Matrix<T> &delta) {
+        if (!sameSize(a, delta))
+            throw std::invalid_argument("Activation::Derivative() - Activations and deltas need to be of same size");
+        NN_PROFILE_SCOPE("activation'");
+        const size_t size = a.rows() * a.cols();
+        const T *x = a.begin();
+        T *d = delta.begin();
+        switch (type) {
+            case Sigmoid:
+                for (size_t i = 0; i < size; ++i)
+                    d[i] *= x[i] * (1 - x[i]);
+                break;
+            case Tanh:
+                for (size_t i = 0; i < size; ++i)
+                    d[i] *= 1 - x[i] * x[i];
+                break;
+            case ReLU:
+                for (size_t i = 0; i < size; ++i)
+                    d[i] = x[i] > 0 ? d[i] : T();
+                break;
+            case Softmax:
+                throw std::invalid_argument("Activation::Derivative() - Softmax is only supported in the output layer");
+        }
+    }
+};
+
+#endif /* ACTIVATION_H */
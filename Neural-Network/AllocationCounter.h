@@ -0,0 +1,56 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Counts every heap allocation made by the program, by replacing the global operator new
+ * and delete. Only for programs that measure their allocations, bench.cpp and tests.cpp,
+ * and like any replacement of them it has to be included in exactly one translation unit.
+ *
+ * The replacements are kept out of line: inlined, GCC sees std::free() called on the
+ * result of operator new and warns of a mismatched deallocation (-Wmismatched-new-delete).
+ *
+ * Example:
+ *
+ *      double allocs = allocationsPerCall([&]{ NN.train(data, labels); }); // 0 once warm
+ */
+std::atomic<long> num_allocations(0);
+
+#define REPLACEMENT __attribute__((noinline))
+REPLACEMENT void* operator new(size_t size) {
+    ++num_allocations;
+    if (void *p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+REPLACEMENT void* operator new[](size_t size) { return operator new(size); }
+REPLACEMENT void operator delete(void *p) noexcept { std::free(p); }
+REPLACEMENT void operator delete[](void *p) noexcept { std::free(p); }
+REPLACEMENT void operator delete(void *p, size_t) noexcept { std::free(p); }
+REPLACEMENT void operator delete[](void *p, size_t) noexcept { std::free(p); }
+REPLACEMENT void* operator new(size_t size, std::align_val_t alignment) { // Matrix, see Matrix::Allocate
+    ++num_allocations;
+    size_t a = size_t(alignment);
+    if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a)) return p;
+    throw std::bad_alloc();
+}
+REPLACEMENT void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+REPLACEMENT void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+#undef REPLACEMENT
+
+/**
+ * Returns the average number of heap allocations made by a call to f, once warm.
+ * The warm-up runs as many calls as are measured, so that every pool thread has
+ * grown its thread local buffers.
+ */
+template<typename F>
+double allocationsPerCall(F f, int calls = 100) {
+    for (int i = 0; i < calls; ++i) f();
+    long before = num_allocations;
+    for (int i = 0; i < calls; ++i) f();
+    return double(num_allocations - before) / calls;
+}
+
+#endif /* ALLOCATIONCOUNTER_H */
@@ -0,0 +1,159 @@
+#ifndef AUGMENTATION_H
+#define AUGMENTATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "IDX.h"
+#include "Random.h"
+#include "Simd.h"
+
+/**
+ * Random distortions of images, applied while they are converted into floating point,
+ * so that training sees a different variation of every image every epoch:
+ *
+ *      shift     the image is moved by up to max_shift pixels along each axis, filled with zeros
+ *      elastic   every pixel is displaced by a random field, uniform in [-1,1] smoothed by
+ *                a Gaussian of standard deviation sigma and scaled by alpha, and the image
+ *                is resampled bilinearly (Simard et al. 2003, alpha 34 and sigma 4 for MNIST)
+ *
+ * The distortion of an image only depends on the stream of random numbers passed to apply
+ * (see Random.h), BatchLoader takes the one of the epoch and the index of the image under
+ * its own seed (see Stream), so augmented epochs are as reproducible as clean ones no matter
+ * which thread converts which image.
+ * A default constructed Augmentation does nothing, apply then only converts.
+ *
+ * apply does not allocate once its Workspace has the size of the images, every thread
+ * converting images keeps one of its own.
+ *
+ * Example:
+ *
+ *      Augmentation augmentation(2, 34, 4);
+ *      Augmentation::Workspace ws;
+ *      augmentation.apply(set.image(i), 28, 28, data.begin(row), Augmentation::Stream(seed, epoch, i), ws);
+ */
+class Augmentation {
+    int max_shift;
+    float alpha;
+    std::vector<float> kernel; // Gaussian of 2 * radius + 1 taps, summing to one
+
+    static constexpr int border = 2; // of zeros around the padded image, for bilinear reads just outside it
+
+    static constexpr int lanes = 16; // rows of the fields are padded to a multiple of this many floats
+    static constexpr int block = 4;  // rows convolved at once, so that their sums do not wait on each other
+
+    /**
+     * out(y, x) = sum of kernel[k] * in[y * in_stride + x + k * step] over all taps k, for
+     * rows [0, rows) of out with the given stride, a whole SIMD register at a time (see Simd.h).
+     * With step 1 that is a convolution along x, with step in_stride one along y.
+     */
+    void convolve(const float *in, int in_stride, int step, float *out, int stride, int rows) const {
+        using S = Simd<float>;
+        for (int y = 0; y < rows; y += block)
+            for (int x = 0; x < stride; x += S::width) {
+                typename S::reg sum[block];
+                for (int r = 0; r < block; ++r)
+                    sum[r] = S::zero();
+                for (size_t k = 0; k < kernel.size(); ++k) {
+                    const typename S::reg w = S::set1(kernel[k]);
+                    const float *p = in + y * in_stride + x + k * step;
+                    for (int r = 0; r < block; ++r)
+                        sum[r] = S::fmadd(w, S::load(p + r * in_stride), sum[r]);
+                }
+                for (int r = 0; r < block; ++r)
+                    S::store(out + (y + r) * stride + x, sum[r]);
+            }
+    }
+
+public:
+    struct Workspace { std::vector<float> uniform, noise, tmp, dx, dy, padded; };
+
+    /**
+     * @param max_shift Largest shift in pixels along each axis, 0 for none
+     * @param elastic_alpha Scale of the elastic displacements in pixels, 0 for none
+     * @param elastic_sigma Standard deviation of their smoothing in pixels
+     */
+    explicit Augmentation(int max_shift = 0, float elastic_alpha = 0, float elastic_sigma = 4) :
+    max_shift(max_shift), alpha(elastic_alpha) {
+        if (max_shift < 0 || elastic_alpha < 0 || elastic_sigma <= 0)
+            throw std::invalid_argument("Augmentation::Constructor() - Invalid argument(s)");
+        const int radius = std::ceil(3 * elastic_sigma);
+        for (int k = -radius; k <= radius; ++k)
+            kernel.push_back(std::exp(-k * k / (2 * elastic_sigma * elastic_sigma)));
+        float sum = 0;
+        for (float k : kernel) sum += k;
+        for (float &k : kernel) k /= sum;
+    }
+
+    bool enabled() const { return max_shift > 0 || alpha > 0; }
+
+    /** Random numbers of the distortion of item index in the given epoch of a run with the given seed. */
+    static Random Stream(unsigned seed, int epoch, int index) {
+        return Random(seed, Random::Augment + (uint64_t(unsigned(epoch)) << 32 | unsigned(index)));
+    }
+
+    /** Distorts the width x height image and writes it into out, scaled to [0,1]. */
+    template <typename T>
+    void apply(const unsigned char *image, int width, int height, T *out, const Random &random, Workspace &ws) const {
+        // uniform in [-1,1), two for the shift then one per pixel of each of the two fields
+        ws.uniform.resize(2 + (alpha > 0) * 2 * width * height);
+        const float *u = ws.uniform.data();
+        random.uniform(ws.uniform.data(), ws.uniform.size(), -1.0f, 1.0f);
+        const int sx = std::min(max_shift, int((u[0] + 1) / 2 * (2 * max_shift + 1)) - max_shift);
+        const int sy = std::min(max_shift, int((u[1] + 1) / 2 * (2 * max_shift + 1)) - max_shift);
+
+        if (alpha == 0) {
+            // whole pixels only, rows are copied and converted as they are
+            for (int y = 0; y < height; ++y) {
+                T *row = out + y * width;
+                std::fill(row, row + width, T());
+                int from = y - sy, begin = std::max(0, sx), end = std::min(width, width + sx);
+                if (from >= 0 && from < height && begin < end)
+                    IDXFile::Decode(image + from * width + begin - sx, end - begin, row + begin);
+            }
+            return;
+        }
+
+        // the noise has radius zeros left and right of every row and the smoothed noise along x
+        // radius rows of zeros above and below, so the convolutions never look outside them
+        const int radius = kernel.size() / 2, stride = (width + lanes - 1) / lanes * lanes;
+        const int rows = (height + block - 1) / block * block, noise_stride = stride + 2 * radius;
+        const int padded_width = width + 2 * border;
+        ws.noise.assign(noise_stride * rows, 0.0f);
+        ws.tmp.assign(stride * (rows + 2 * radius), 0.0f);
+        ws.dx.resize(stride * rows);
+        ws.dy.resize(stride * rows);
+        float *dx = ws.dx.data(), *dy = ws.dy.data(), *noise = ws.noise.data(), *tmp = ws.tmp.data();
+        for (float *field : {dx, dy}) {
+            const float *values = u + 2 + (field == dy) * width * height;
+            for (int y = 0; y < height; ++y)
+                std::copy(values + y * width, values + (y + 1) * width, noise + y * noise_stride + radius);
+            convolve(noise, noise_stride, 1, tmp + radius * stride, stride, rows);
+            convolve(tmp, stride, stride, field, stride, rows);
+        }
+
+        // a copy with a border of zeros, so that the samples need no bounds checks
+        ws.padded.assign(padded_width * (height + 2 * border), 0.0f);
+        const float *padded = ws.padded.data() + border * padded_width + border;
+        for (int y = 0; y < height; ++y)
+            std::copy(image + y * width, image + (y + 1) * width, ws.padded.data() + (y + border) * padded_width + border);
+
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                float fx = x - sx + alpha * dx[y * stride + x], fy = y - sy + alpha * dy[y * stride + x];
+                // anything further out than one pixel samples zeros only
+                fx = std::min(std::max(fx, -1.0f), float(width));
+                fy = std::min(std::max(fy, -1.0f), float(height));
+                int x0 = int(fx + 1) - 1, y0 = int(fy + 1) - 1; // floor, both are at least -1
+                float wx = fx - x0, wy = fy - y0;
+                const float *p = padded + y0 * padded_width + x0;
+                float top = (1 - wx) * p[0] + wx * p[1];
+                float bottom = (1 - wx) * p[padded_width] + wx * p[padded_width + 1];
+                out[y * width + x] = T(((1 - wy) * top + wy * bottom) * (1.0f / 255));
+            }
+    }
+};
+
+#endif /* AUGMENTATION_H */
@@ -0,0 +1,41 @@
+#ifndef BFLOAT16_H
+#define BFLOAT16_H
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * 16-bit brain floating point, the upper half of an IEEE float.
+ * Keeps the range of float with 8 bits of precision, meant as a storage type
+ * only: arithmetic converts to float, and the Matrix *-operator multiplies a
+ * float matrix with a bfloat16 matrix accumulating in float (see Gemm.h).
+ *
+ * Example:
+ *
+ *      Matrix<bfloat16> W16 = W;  // W is a Matrix<float>, half the memory
+ *      Matrix<float> Z = A * W16; // fp32 accumulation
+ */
+struct bfloat16 {
+    uint16_t bits;
+
+    bfloat16() = default;
+
+    /** Rounds to nearest, ties to even. NaN stays NaN. */
+    bfloat16(float f) {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        if ((u & 0x7fffffff) > 0x7f800000)
+            bits = (u >> 16) | 0x40; // quiet NaN
+        else
+            bits = (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+    }
+
+    operator float() const {
+        uint32_t u = uint32_t(bits) << 16;
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+};
+
+#endif /* BFLOAT16_H */
@@ -0,0 +1,192 @@
+#ifndef BATCHLOADER_H
+#define BATCHLOADER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Augmentation.h"
+#include "Matrix.h"
+#include "MNIST.h"
+#include "Profiler.h"
+#include "Random.h"
+#include "SparseMatrix.h"
+#include "ThreadPool.h"
+
+/**
+ * Streams shuffled mini-batches of a data set, prepared on a background thread.
+ *
+ * Every epoch the producer thread shuffles the sample indices, then gathers and
+ * converts one batch at a time into one of two reused buffers. While the trainer
+ * works on one buffer the next batch is written into the other, so preparing data
+ * overlaps with training and costs no memory beyond the two batches.
+ * Samples that do not fill a whole batch at the end of an epoch are skipped that epoch.
+ *
+ * The images of a batch can be distorted on the fly (see Augmentation.h), and with more
+ * than one thread the producer spreads the images of every batch over a pool of its own,
+ * so that even elastic distortions are ready before the trainer asks for the batch and
+ * an augmented epoch takes no longer than a clean one.
+ *
+ * A sparse loader also stores every batch as a SparseMatrix, built on the producer thread,
+ * for NeuralNetwork::train to skip the zero pixels in the first layer.
+ *
+ * The shuffle of an epoch only depends on the seed and the number of the epoch, it is
+ * the stream of the epoch of the seed (see Random.h), and so does the distortion of an
+ * image, whichever thread prepares it. So a
+ * loader created with the same seed and the position() of another one continues
+ * with exactly the batches the other one would have returned, e.g to resume training
+ * from a checkpoint (see Checkpointer.h).
+ *
+ * Example:
+ *
+ *      BatchLoader<double> loader(MNIST::Open(MNIST::TrainingSet), 120);
+ *      for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+ *          auto &batch = loader.next(); // valid until the next call to next()
+ *          NN.train(batch.data, batch.labels);
+ *      }
+ *
+ *      BatchLoader<double> augmented(MNIST::Open(MNIST::TrainingSet), 120, seed, {0, 0}, 2, Augmentation(2, 34, 4));
+ */
+template <typename T = double>
+class BatchLoader {
+public:
+    struct Batch {
+        Matrix<T> data, labels;
+        SparseMatrix<T> sparse; // the data again, if the loader is sparse, see SparseMatrix.h
+    };
+
+    /** Epoch and index within it of a batch. */
+    struct Position { int epoch, batch; };
+
+private:
+    const MNIST::Dataset set;
+    const int batch_size;
+    const unsigned shuffle_seed;
+    const Position start;
+    Position consumer; // of the batch the next call to next() returns
+    std::vector<int> order;
+    const Augmentation augmentation;
+    const bool sparse;
+    ThreadPool pool; // converting the images of a batch
+    std::vector<Augmentation::Workspace> workspaces; // one per thread of the pool
+
+    Batch slots[2];
+    bool full[2] = {false, false};
+    int consumed = -1; // slot held by the consumer, -1 if none
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread producer;
+
+    void produce() {
+        for (int epoch = start.epoch, slot = 0; ; ++epoch) {
+            std::iota(order.begin(), order.end(), 0);
+            Random(shuffle_seed, Random::Shuffle + epoch).shuffle(order.begin(), order.end());
+            for (int b = epoch == start.epoch ? start.batch : 0; b < batchesPerEpoch(); ++b, slot ^= 1) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]{ return stop || !full[slot]; });
+                    if (stop)
+                        return;
+                }
+                // the consumer never touches a slot that is not full
+                prepare(slots[slot], &order[b * batch_size], epoch);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    full[slot] = true;
+                }
+                cv.notify_all();
+            }
+        }
+    }
+
+    void prepare(Batch &batch, const int *indexes, int epoch) {
+        prepareDense(batch, indexes, epoch);
+        if (sparse) {
+            NN_PROFILE_SCOPE("sparse batch");
+            batch.sparse.assign(batch.data);
+        }
+    }
+
+    void prepareDense(Batch &batch, const int *indexes, int epoch) {
+        NN_PROFILE_SCOPE("prepare batch");
+        if (!augmentation.enabled() && pool.size() == 1) {
+            set.batch(indexes, batch_size, batch.data, batch.labels);
+            return;
+        }
+        set.batchLabels(indexes, batch_size, batch.labels);
+        batch.data.resize(batch_size, set.inputs());
+        const int threads = pool.size();
+        pool.parallelFor(threads, [&](int thread){
+            for (int i = thread; i < batch_size; i += threads) {
+                const unsigned char *image = set.image(indexes[i]);
+                if (augmentation.enabled())
+                    augmentation.apply(image, set.width(), set.height(), batch.data.begin(i),
+                                       Augmentation::Stream(shuffle_seed, epoch, indexes[i]), workspaces[thread]);
+                else
+                    IDXFile::Decode(image, set.inputs(), batch.data.begin(i));
+            }
+        });
+    }
+
+public:
+    /**
+     * @param set Data set to stream batches from, the loader keeps it open
+     * @param seed Seed of the shuffling
+     * @param start Position of the first batch returned
+     * @param threads Number of threads preparing a batch, the producer thread included
+     * @param augmentation Distortion of the images, none by default
+     * @param sparse Whether to also store every batch as a SparseMatrix
+     */
+    BatchLoader(MNIST::Dataset &&set, int batch_size, unsigned seed = std::random_device()(), Position start = {0, 0},
+                int threads = 1, const Augmentation &augmentation = Augmentation(), bool sparse = false) :
+    set(std::move(set)), batch_size(batch_size), shuffle_seed(seed), start(start), consumer(start), order(this->set.size()),
+    augmentation(augmentation), sparse(sparse), pool(threads), workspaces(threads) {
+        if (batch_size < 1 || batch_size > this->set.size())
+            throw std::invalid_argument("BatchLoader::Constructor() - Invalid batch size");
+        if (start.epoch < 0 || start.batch < 0 || start.batch >= batchesPerEpoch())
+            throw std::invalid_argument("BatchLoader::Constructor() - Invalid start position");
+        producer = std::thread([this]{ produce(); });
+    }
+
+    ~BatchLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        producer.join();
+    }
+
+    int batchesPerEpoch() const { return set.size() / batch_size; }
+    int batchSize() const { return batch_size; }
+    unsigned seed() const { return shuffle_seed; }
+
+    /** Position of the batch the next call to next() returns. */
+    Position position() const { return consumer; }
+
+    /**
+     * Returns the next batch, waiting for it if it is not ready yet.
+     * Hands the previously returned batch back to the producer, so it is only
+     * valid until the next call.
+     */
+    const Batch& next() {
+        NN_PROFILE_SCOPE("next batch");
+        std::unique_lock<std::mutex> lock(mutex);
+        int slot = consumed == -1 ? 0 : consumed ^ 1;
+        if (consumed != -1) {
+            full[consumed] = false;
+            cv.notify_all();
+        }
+        cv.wait(lock, [&]{ return full[slot]; });
+        consumed = slot;
+        if (++consumer.batch == batchesPerEpoch())
+            consumer = {consumer.epoch + 1, 0};
+        return slots[slot];
+    }
+};
+
+#endif /* BATCHLOADER_H */
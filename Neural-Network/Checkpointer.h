@@ -0,0 +1,198 @@
+#ifndef CHECKPOINTER_H
+#define CHECKPOINTER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "StateFile.h"
+
+/**
+ * Periodic checkpoints of training, written on a background thread.
+ *
+ * snapshot copies the parameters of the network and the moments of its optimizer into
+ * a buffer of the checkpointer and returns, the file is written by its own thread
+ * meanwhile. So the training loop only pays for a copy of the weights, never for the disk. If a snapshot
+ * is taken while the previous one is still being written, the newer one replaces any
+ * snapshot still waiting, i.e the file always ends up with the latest.
+ *
+ * A checkpoint is a binary state file (see StateFile.h), with the progress of training,
+ * the position of the next batch, the seed of the shuffling (see BatchLoader.h), the best
+ * test accuracy so far with its epoch, and the number of steps of the optimizer, stored as its metadata. With plain SGD it holds no
+ * moments and NeuralNetwork::readState reads it like any other state file.
+ * StateFile::Write replaces the old checkpoint by renaming a temporary file over it, so
+ * a run killed while writing leaves the previous checkpoint intact.
+ *
+ * Example:
+ *
+ *      Checkpointer<> checkpointer("run.state");
+ *      auto progress = Checkpointer<>::Resume("run.state", NN); // after preemption
+ *      BatchLoader<> loader(MNIST::Open(MNIST::TrainingSet), 120, progress.seed, {progress.epoch, progress.batch});
+ *      ...
+ *      checkpointer.snapshot(NN, {loader.position().epoch, loader.position().batch, loader.seed()});
+ */
+template <typename T = double>
+class Checkpointer {
+public:
+    /**
+     * Where training stands besides the network: the next batch, the seed of the shuffling,
+     * and the best test accuracy of the epochs so far with its epoch, -1 before any, for early stopping.
+     */
+    struct Progress {
+        int epoch, batch;
+        unsigned seed;
+        double best = -1;
+        int best_epoch = -1;
+    };
+
+private:
+    struct Snapshot {
+        std::vector<Matrix<T>> blocks; // NeuralNetwork::parameters(true)
+        Progress progress;
+        long steps;
+    };
+
+    const std::string file_path;
+    Snapshot pending, writing;
+    bool has_pending = false, busy = false, stop = false;
+    long num_written = 0;
+    std::string error; // of the last failed write, thrown by the next call
+
+    std::mutex mutex;
+    std::condition_variable cv, idle;
+    std::thread writer;
+
+    static std::string encode(const Snapshot &snapshot) {
+        std::ostringstream os;
+        os.precision(17); // the best accuracy exactly as it was
+        os << "epoch " << snapshot.progress.epoch << " batch " << snapshot.progress.batch
+           << " seed " << snapshot.progress.seed << " steps " << snapshot.steps
+           << " best " << snapshot.progress.best << " best_epoch " << snapshot.progress.best_epoch;
+        return os.str();
+    }
+
+    void writeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [&]{ return stop || has_pending; });
+            if (!has_pending)
+                return;
+            std::swap(pending, writing);
+            has_pending = false;
+            busy = true;
+            lock.unlock();
+
+            std::string failure;
+            try {
+                std::vector<const Matrix<T>*> blocks;
+                for (auto &m : writing.blocks)
+                    blocks.push_back(&m);
+                StateFile::Write<T>(file_path, blocks, encode(writing));
+            } catch (const std::exception &e) {
+                failure = e.what();
+            }
+
+            lock.lock();
+            busy = false;
+            if (failure.empty())
+                ++num_written;
+            else
+                error = failure;
+            idle.notify_all();
+        }
+    }
+
+    void throwIfFailed(const std::string &method) {
+        if (error.empty())
+            return;
+        std::string e = error;
+        error.clear();
+        throw std::runtime_error("Checkpointer::" + method + "() - " + e);
+    }
+
+public:
+    explicit Checkpointer(const std::string &file_path) : file_path(file_path) {
+        writer = std::thread([this]{ writeLoop(); });
+    }
+
+    /** Writes the last snapshot, if any is waiting, before returning. */
+    ~Checkpointer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        writer.join();
+    }
+
+    Checkpointer(const Checkpointer&) = delete;
+    void operator=(const Checkpointer&) = delete;
+
+    /**
+     * Copies the state of the network and queues it to be written with the given progress.
+     * Does not wait for the disk, and reuses its buffers once they have the size of the
+     * network. Throws if writing an earlier snapshot failed.
+     */
+    void snapshot(const NeuralNetwork<T> &NN, Progress progress) {
+        std::lock_guard<std::mutex> lock(mutex);
+        throwIfFailed("snapshot");
+        auto parameters = NN.parameters(true);
+        pending.blocks.resize(parameters.size());
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            pending.blocks[i].resize(parameters[i]->rows(), parameters[i]->cols());
+            std::copy(parameters[i]->begin(), parameters[i]->end(), pending.blocks[i].begin());
+        }
+        pending.progress = progress;
+        pending.steps = NN.optimizer().steps();
+        has_pending = true;
+        cv.notify_one();
+    }
+
+    /** Waits until every snapshot taken so far is written. Throws if writing one failed. */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [&]{ return !has_pending && !busy; });
+        throwIfFailed("flush");
+    }
+
+    /** Number of checkpoints written so far. */
+    long written() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return num_written;
+    }
+
+    static bool Exists(const std::string &file_path) {
+        return std::ifstream(file_path).good();
+    }
+
+    /**
+     * Reads the checkpoint at file_path into the network and its optimizer, and returns
+     * the progress of training stored with it. Throws if the file is not a checkpoint of
+     * this network, or of one with a different kind of optimizer.
+     */
+    static Progress Resume(const std::string &file_path, NeuralNetwork<T> &NN) {
+        std::istringstream is(StateFile::Metadata(file_path));
+        std::string epoch, batch, seed, steps;
+        Progress progress;
+        long num_steps;
+        if (!(is >> epoch >> progress.epoch >> batch >> progress.batch >> seed >> progress.seed >> steps >> num_steps) ||
+            epoch != "epoch" || batch != "batch" || seed != "seed" || steps != "steps")
+            throw std::runtime_error("Checkpointer::Resume() - Not a checkpoint: " + file_path);
+        std::string best, best_epoch; // missing in checkpoints written before they were kept, which then start without
+        if (is >> best && !(best == "best" && is >> progress.best >> best_epoch >> progress.best_epoch && best_epoch == "best_epoch"))
+            throw std::runtime_error("Checkpointer::Resume() - Not a checkpoint: " + file_path);
+        StateFile::Read<T>(file_path, NN.parameters(true));
+        NN.weightsChanged();
+        NN.optimizer().setSteps(num_steps);
+        return progress;
+    }
+};
+
+#endif /* CHECKPOINTER_H */
@@ -0,0 +1,99 @@
+#ifndef CONFUSIONMATRIX_H
+#define CONFUSIONMATRIX_H
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Counts of classifications of a labelled data set, by actual and predicted class.
+ * The diagonal holds the correct classifications, see NeuralNetwork::confusionMatrix.
+ *
+ * Example:
+ *
+ *      ConfusionMatrix confusion = NN.confusionMatrix(MNIST::Open(MNIST::TestSet));
+ *      confusion.percentCorrect();   // e.g 97.1
+ *      confusion.classAccuracy(8);   // percent of the eights classified as eights
+ *      confusion(3, 5);              // threes classified as fives
+ */
+class ConfusionMatrix {
+    int n;
+    std::vector<long> counts; // counts[actual * n + predicted]
+
+    void checkClass(int c) const {
+        if (c < 0 || c >= n)
+            throw std::out_of_range("ConfusionMatrix - Class out of range");
+    }
+
+public:
+    explicit ConfusionMatrix(int classes) : n(classes), counts(classes * classes) {
+        if (classes < 1)
+            throw std::invalid_argument("ConfusionMatrix::Constructor() - Need at least one class");
+    }
+
+    void add(int actual, int predicted) {
+        checkClass(actual);
+        checkClass(predicted);
+        ++counts[actual * n + predicted];
+    }
+
+    void operator+=(const ConfusionMatrix &other) {
+        if (other.n != n)
+            throw std::invalid_argument("ConfusionMatrix::addition - Not same number of classes");
+        std::transform(counts.begin(), counts.end(), other.counts.begin(), counts.begin(), std::plus<long>());
+    }
+
+    /** Number of items of class actual that were classified as predicted. */
+    long operator()(int actual, int predicted) const {
+        checkClass(actual);
+        checkClass(predicted);
+        return counts[actual * n + predicted];
+    }
+
+    int classes() const { return n; }
+    long total() const { return std::accumulate(counts.begin(), counts.end(), 0L); }
+
+    long correct() const {
+        long sum = 0;
+        for (int c = 0; c < n; ++c)
+            sum += counts[c * n + c];
+        return sum;
+    }
+
+    /** Number of items of the class, i.e the sum of its row. */
+    long classTotal(int c) const {
+        checkClass(c);
+        return std::accumulate(counts.begin() + c * n, counts.begin() + (c + 1) * n, 0L);
+    }
+
+    double percentCorrect() const { return total() ? 100.0 * correct() / total() : 0; }
+
+    /** Percentage of the items of the class that were classified correctly (its recall). */
+    double classAccuracy(int c) const {
+        long items = classTotal(c);
+        return items ? 100.0 * counts[c * n + c] / items : 0;
+    }
+
+    /** Prints the matrix, one row per actual class, followed by the accuracy of every class. */
+    void print(std::ostream &os) const {
+        auto flags = os.flags();
+        auto precision = os.precision();
+        os << "> actual \\ predicted";
+        for (int p = 0; p < n; ++p)
+            os << std::setw(7) << p;
+        os << " | accuracy\n";
+        for (int a = 0; a < n; ++a) {
+            os << ">" << std::setw(19) << a;
+            for (int p = 0; p < n; ++p)
+                os << std::setw(7) << counts[a * n + p];
+            os << " | " << std::fixed << std::setprecision(2) << std::setw(6) << classAccuracy(a) << "%\n";
+        }
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+#endif /* CONFUSIONMATRIX_H */
@@ -0,0 +1,94 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "Simd.h"
+
+/**
+ * Vectorized exp, sigmoid and tanh on whole SIMD registers (see Simd.h), used by
+ * the activation functions instead of calling std::exp once per element.
+ *
+ * exp(x) is computed as 2^n * exp(r) where n = round(x / ln 2) and r = x - n ln 2,
+ * so |r| <= ln 2 / 2 and a Taylor polynomial evaluated with fused multiply-adds
+ * is enough: degree 6 for float and degree 13 for double, whose truncation error is
+ * below the rounding error of the type. Measured against std::exp the relative error
+ * stays within a few units in the last place (see "make bench").
+ * x is clamped to the range where 2^n is a normal number, so large negative inputs
+ * give a tiny positive value instead of zero and large positive ones a huge finite value.
+ *
+ * Without SIMD, i.e for the scalar fallback of Simd<T>, exp is std::exp.
+ *
+ * sigmoid(x) = 1 / (1 + exp(-x)) and tanh(x) = 2 sigmoid(2x) - 1 inherit that bound,
+ * tanh as an absolute error close to zero.
+ *
+ * Example:
+ *
+ *      using S = Simd<float>;
+ *      S::store(p, FastMath<float>::sigmoid(S::load(p)));
+ *      FastMath<float>::apply(p, n, FastMath<float>::exp); // whole array in place
+ */
+template <typename T>
+class FastMath {
+    using S = Simd<T>;
+    using reg = typename S::reg;
+
+    static constexpr int degree = sizeof(T) <= 4 ? 6 : 13;
+    static constexpr T max_x = sizeof(T) <= 4 ? 88 : 709;
+    static constexpr T min_x = -max_x + 1;
+    static constexpr T log2e = 1.44269504088896340736;
+    // ln 2 split in two, ln2_hi * n is exact for the n we use
+    static constexpr T ln2_hi = sizeof(T) <= 4 ? 0.693359375 : 6.93147180369123816490e-01;
+    static constexpr T ln2_lo = sizeof(T) <= 4 ? -2.12194440e-4 : 1.90821492927058770002e-10;
+
+    FastMath() {/* To prevent instantiation */}
+
+public:
+    static reg exp(reg x) {
+        if constexpr (S::width == 1)
+            return std::exp(x); // no SIMD, libm is faster than the polynomial one element at a time
+        x = S::min(S::max(x, S::set1(min_x)), S::set1(max_x));
+        reg n = S::round(S::mul(x, S::set1(log2e)));
+        reg r = S::fmadd(n, S::set1(-ln2_hi), x);
+        r = S::fmadd(n, S::set1(-ln2_lo), r);
+
+        // 1 + r (1 + r/2 (1 + r/3 (...)))
+        reg one = S::set1(1), p = one;
+        for (int k = degree; k >= 1; --k)
+            p = S::fmadd(S::mul(r, S::set1(T(1) / k)), p, one);
+        return S::scale2(p, n);
+    }
+
+    static reg sigmoid(reg x) {
+        reg one = S::set1(1);
+        return S::div(one, S::add(one, exp(S::sub(S::zero(), x))));
+    }
+
+    static reg tanh(reg x) {
+        reg one = S::set1(1), two = S::set1(2);
+        return S::sub(S::div(two, S::add(one, exp(S::mul(S::set1(-2), x)))), one);
+    }
+
+    /**
+     * Replaces x[i] with f(x[i] + bias[i]) for i in [0, n), where f is one of the functions
+     * above. bias may be null. The last partial register goes through a padded buffer.
+     */
+    template <typename F>
+    static void apply(T *x, size_t n, F f, const T *bias = nullptr) {
+        size_t i = 0;
+        for (; i + S::width <= n; i += S::width) {
+            reg v = S::load(x + i);
+            S::store(x + i, f(bias ? S::add(v, S::load(bias + i)) : v));
+        }
+        if (i == n)
+            return;
+        T tail[S::width] = {};
+        for (size_t j = i; j < n; ++j)
+            tail[j - i] = bias ? x[j] + bias[j] : x[j];
+        S::store(tail, f(S::load(tail)));
+        std::copy(tail, tail + (n - i), x + i);
+    }
+};
+
+#endif /* FASTMATH_H */
@@ -0,0 +1,141 @@
+#ifndef FIXEDMATRIX_H
+#define FIXEDMATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include "Gemm.h"
+#include "Matrix.h"
+#include "Simd.h"
+
+/**
+ * Matrix whose dimensions are known at compile time, stored inline (on the stack or
+ * inside the owning object) and aligned to a cache line, with every row padded with zeros
+ * to a whole number of SIMD registers (see Simd.h). operator() does not check its
+ * indices, at() does.
+ *
+ * Meant for small operands of known shape, like the weights of the output layer of
+ * a network for MNIST, e.g 20x10 or 64x10. multiply below computes a batch of any
+ * number of rows times such a matrix with a kernel specialized on its shape: with K
+ * and N constants every padded row is a fixed number of registers, so a block of rows
+ * of the result stays in registers while the matrix is streamed through once, where
+ * the packed GEMM of Gemm.h pays for packing and tiling that an operand this small
+ * does not need (see "make bench SECTION=fixed").
+ * Matrix<T> stays the general case, FixedMatrix converts to and from it. NeuralNetwork runs
+ * a layer through it once told its shape at compile time (see NeuralNetwork::fixLayer).
+ *
+ * Example:
+ *
+ *      FixedMatrix<double, 20, 10> W2(NN.weights(1)); // throws unless NN.weights(1) is 20x10
+ *      multiply(out, hidden, W2);                      // out = hidden * W2, hidden is n x 20
+ */
+template <typename T, size_t Rows, size_t Cols>
+class FixedMatrix {
+    static_assert(Rows > 0 && Cols > 0, "FixedMatrix - Dimensions have to be positive");
+
+public:
+    /** Distance between rows, Cols padded with zeros to a whole number of SIMD registers. */
+    static constexpr size_t stride = (Cols + Simd<T>::width - 1) / Simd<T>::width * Simd<T>::width;
+
+private:
+    alignas(64) T m_vec[Rows * stride] = {};
+
+public:
+    using value_type = T;
+
+    FixedMatrix() = default;
+
+    explicit FixedMatrix(const Matrix<T> &m) { assign(m); }
+
+    /** Copies the values of m, which has to be Rows x Cols, into this matrix, the padding stays zero. */
+    void assign(const Matrix<T> &m) {
+        if (m.rows() != Rows || m.cols() != Cols)
+            throw std::invalid_argument("FixedMatrix::assign() - Dimensions do not match");
+        for (size_t i = 0; i < Rows; ++i)
+            std::copy(m.begin(i), m.end(i), begin(i));
+    }
+
+    Matrix<T> toMatrix() const {
+        Matrix<T> m(Rows, Cols);
+        for (size_t i = 0; i < Rows; ++i)
+            std::copy(begin(i), end(i), m.begin(i));
+        return m;
+    }
+
+    static constexpr size_t rows() { return Rows; }
+    static constexpr size_t cols() { return Cols; }
+
+    T  operator()(size_t row, size_t col) const { return m_vec[row * stride + col]; }
+    T& operator()(size_t row, size_t col)       { return m_vec[row * stride + col]; }
+
+    T at(size_t row, size_t col) const {
+        if (row >= Rows || col >= Cols)
+            throw std::out_of_range("FixedMatrix::at() - Index out of range");
+        return m_vec[row * stride + col];
+    }
+
+    void reset() { std::fill(m_vec, m_vec + Rows * stride, T()); }
+
+    T* begin(size_t row = 0) { return m_vec + stride * row; }
+    T* end(size_t row) { return begin(row) + Cols; }
+    const T* begin(size_t row = 0) const { return m_vec + stride * row; }
+    const T* end(size_t row) const { return begin(row) + Cols; }
+
+    /**
+     * c = a * this for R rows of a, i.e R x Rows times Rows x Cols. The R x stride block
+     * of c stays in registers for the whole loop over the rows of this matrix, which are
+     * loaded once and used R times.
+     */
+    template <size_t R>
+    void multiplyRows(const T *a, size_t lda, T *c, size_t ldc) const {
+        using S = Simd<T>;
+        constexpr size_t V = stride / S::width;
+        typename S::reg acc[R][V];
+        for (size_t r = 0; r < R; ++r)
+            for (size_t v = 0; v < V; ++v)
+                acc[r][v] = S::zero();
+        for (size_t k = 0; k < Rows; ++k) {
+            typename S::reg row[V];
+            for (size_t v = 0; v < V; ++v)
+                row[v] = S::load(begin(k) + v * S::width);
+            for (size_t r = 0; r < R; ++r) {
+                typename S::reg x = S::set1(a[r * lda + k]);
+                for (size_t v = 0; v < V; ++v)
+                    acc[r][v] = S::fmadd(x, row[v], acc[r][v]);
+            }
+        }
+        for (size_t r = 0; r < R; ++r) {
+            alignas(64) T out[stride];
+            for (size_t v = 0; v < V; ++v)
+                S::store(out + v * S::width, acc[r][v]);
+            std::copy(out, out + Cols, c + r * ldc);
+        }
+    }
+};
+
+/**
+ * c = a * b where a has K columns and any number of rows, and is a Matrix or a MatrixView.
+ * c is resized to a.rows() x N. The epilogue is called on every finished row of c, like in Gemm::multiply.
+ */
+template <typename T, typename A, size_t K, size_t N, typename Epilogue = typename Gemm<T>::NoEpilogue,
+          typename = typename std::enable_if<is_dense<A>::value>::type>
+void multiply(Matrix<T> &c, const A &a, const FixedMatrix<T, K, N> &b, Epilogue epilogue = Epilogue()) {
+    if (a.cols() != K)
+        throw std::invalid_argument("FixedMatrix::multiplication - Not correct dimensions");
+    c.resize(a.rows(), N);
+
+    // as many rows at a time as leave registers for the accumulators, 32 of them with AVX-512
+    constexpr size_t V = FixedMatrix<T, K, N>::stride / Simd<T>::width;
+    constexpr size_t R = V == 1 ? 8 : V == 2 ? 6 : 4;
+    for (size_t i = 0; i < a.rows(); ) {
+        size_t rows = a.rows() - i >= R ? R : 1;
+        if (rows == R)
+            b.template multiplyRows<R>(a.begin(i), a.stride(), c.begin(i), N);
+        else
+            b.template multiplyRows<1>(a.begin(i), a.stride(), c.begin(i), N);
+        for (size_t end = i + rows; i < end; ++i)
+            epilogue(c.begin(i), 0, N);
+    }
+}
+
+#endif /* FIXEDMATRIX_H */
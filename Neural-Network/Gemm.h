@@ -0,0 +1,200 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "Simd.h"
+
+/**
+ * Cache-blocked, register-blocked general matrix multiplication, C = op(A) * op(B),
+ * on row-major arrays where op(X) is either X or its transpose. Used by the
+ * *-operator of the Matrix class.
+ *
+ * Follows the usual packed approach: B is copied into KC x NC panels and A into
+ * MC x KC blocks laid out so that the micro-kernel reads both strictly sequentially.
+ * A transposed operand is handled while packing, so it is never materialized.
+ * The micro-kernel keeps an MR x NR tile of C in SIMD registers and
+ * updates it with one broadcast and NR / width fused multiply-adds per row and k.
+ *
+ * Register blocking is picked from Simd<T> at compile time, so float and double
+ * get the AVX-512/AVX2 kernels and every other type gets the scalar fallback.
+ *
+ * T is the type of C and of the arithmetic. A and B may be stored in another type,
+ * e.g bfloat16, which is converted to T while packing, so Gemm<float> on bfloat16
+ * operands reads half the bytes and still accumulates in float.
+ *
+ * An optional epilogue is called on every part of a row of C once it holds its final
+ * value, right after the micro-kernel wrote it, so element-wise work on the output
+ * (e.g adding a bias and applying an activation function) happens while it is in L1.
+ *
+ * Example:
+ *
+ *      // C (MxN) = A (MxK) * B (KxN), all row-major with leading dimensions K, N, N
+ *      Gemm<double>::multiply(false, false, M, N, K, A, K, B, N, C, N);
+ *
+ *      // C (MxN) = A^T * B, where A is stored as KxM
+ *      Gemm<double>::multiply(true, false, M, N, K, A, M, B, N, C, N);
+ */
+template <typename T>
+class Gemm {
+    using S = Simd<T>;
+
+    static constexpr int NV = S::width == 1 ? 4 : 2;  // vectors per row of the tile
+    static constexpr int MR = S::width == 1 ? 4 : 6;  // rows of the register tile
+    static constexpr int NR = NV * S::width;          // cols of the register tile
+    static constexpr size_t KC = 256;                 // depth of a packed panel, fits L1
+    static constexpr size_t MC = MR * 16;             // rows of a packed A block, fits L2
+    static constexpr size_t NC = NR * 128;            // cols of a packed B panel, fits L3
+
+    /**
+     * Packs an mc x kc block of op(A) into MR-row strips, zero padding the last strip.
+     * If trans is set the block is read from A stored as kc x mc, row by row.
+     */
+    template <typename TA>
+    static void packA(bool trans, size_t mc, size_t kc, const TA *a, size_t lda, T *buf) {
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t m = std::min<size_t>(MR, mc - ir);
+            for (size_t p = 0; p < kc; ++p) {
+                if (trans) {
+                    const TA *row = a + p * lda + ir;
+                    std::copy(row, row + m, buf);
+                } else {
+                    for (size_t i = 0; i < m; ++i)
+                        buf[i] = a[(ir + i) * lda + p];
+                }
+                std::fill(buf + m, buf + MR, T());
+                buf += MR;
+            }
+        }
+    }
+
+    /**
+     * Packs a kc x nc panel of op(B) into NR-col strips, zero padding the last strip.
+     * If trans is set the panel is read from B stored as nc x kc, row by row.
+     */
+    template <typename TB>
+    static void packB(bool trans, size_t kc, size_t nc, const TB *b, size_t ldb, T *buf) {
+        for (size_t jr = 0; jr < nc; jr += NR, buf += kc * NR) {
+            size_t n = std::min<size_t>(NR, nc - jr);
+            if (trans) {
+                for (size_t j = 0; j < n; ++j) {
+                    const TB *row = b + (jr + j) * ldb;
+                    for (size_t p = 0; p < kc; ++p)
+                        buf[p * NR + j] = row[p];
+                }
+                for (size_t p = 0; p < kc; ++p)
+                    std::fill(buf + p * NR + n, buf + (p + 1) * NR, T());
+            } else {
+                for (size_t p = 0; p < kc; ++p) {
+                    const TB *row = b + p * ldb + jr;
+                    std::copy(row, row + n, buf + p * NR);
+                    std::fill(buf + p * NR + n, buf + (p + 1) * NR, T());
+                }
+            }
+        }
+    }
+
+    /**
+     * Computes an MR x NR tile of packed A times packed B and writes the
+     * top-left m x n part of it into C, added to C if accumulate is set.
+     */
+    static void kernel(size_t kc, const T *a, const T *b, T *c, size_t ldc, size_t m, size_t n, bool accumulate) {
+        typename S::reg acc[MR][NV];
+        for (int i = 0; i < MR; ++i)
+            for (int v = 0; v < NV; ++v)
+                acc[i][v] = S::zero();
+
+        for (size_t p = 0; p < kc; ++p, a += MR, b += NR) {
+            typename S::reg bv[NV];
+            for (int v = 0; v < NV; ++v)
+                bv[v] = S::load(b + v * S::width);
+            for (int i = 0; i < MR; ++i) {
+                typename S::reg ai = S::set1(a[i]);
+                for (int v = 0; v < NV; ++v)
+                    acc[i][v] = S::fmadd(ai, bv[v], acc[i][v]);
+            }
+        }
+
+        if (m == MR && n == NR) {
+            for (int i = 0; i < MR; ++i) {
+                for (int v = 0; v < NV; ++v) {
+                    T *dst = c + i * ldc + v * S::width;
+                    S::store(dst, accumulate ? S::add(S::load(dst), acc[i][v]) : acc[i][v]);
+                }
+            }
+            return;
+        }
+
+        T tile[MR * NR];
+        for (int i = 0; i < MR; ++i)
+            for (int v = 0; v < NV; ++v)
+                S::store(tile + i * NR + v * S::width, acc[i][v]);
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                c[i * ldc + j] = accumulate ? c[i * ldc + j] + tile[i * NR + j] : tile[i * NR + j];
+    }
+
+    Gemm() {/* To prevent instantiation */}
+
+public:
+    /** Default epilogue, does nothing. */
+    struct NoEpilogue { void operator()(T*, size_t, size_t) const { } };
+
+    /**
+     * Computes C = op(A) * op(B), or C += op(A) * op(B) if accumulate is set.
+     * op(A) is MxK, op(B) is KxN and C is MxN, all row-major with the given leading dimensions.
+     * If transA (transB) is set A (B) is stored transposed, i.e as KxM (NxK).
+     *
+     * @param epilogue Called as epilogue(p, col, n) for every finished part p[0..n) of a row of C
+     *                 starting at column col. Every element of C is passed exactly once.
+     */
+    template <typename TA, typename TB, typename Epilogue = NoEpilogue>
+    static void multiply(bool transA, bool transB, size_t M, size_t N, size_t K,
+                         const TA *a, size_t lda,
+                         const TB *b, size_t ldb,
+                         T *c, size_t ldc, bool accumulate = false, Epilogue epilogue = Epilogue()) {
+        if (M == 0 || N == 0)
+            return;
+        if (K == 0) {
+            for (size_t i = 0; i < M; ++i) {
+                if (!accumulate)
+                    std::fill(c + i * ldc, c + i * ldc + N, T());
+                epilogue(c + i * ldc, 0, N);
+            }
+            return;
+        }
+
+        // grows once to the largest block size, steady state does no allocation
+        thread_local std::vector<T> bufA, bufB;
+        bufA.resize(std::max(bufA.size(), MC * KC));
+        bufB.resize(std::max(bufB.size(), KC * ((std::min(NC, N) + NR - 1) / NR * NR)));
+
+        for (size_t jc = 0; jc < N; jc += NC) {
+            size_t nc = std::min(NC, N - jc);
+            for (size_t pc = 0; pc < K; pc += KC) {
+                size_t kc = std::min(KC, K - pc);
+                bool acc = accumulate || pc > 0;
+                packB(transB, kc, nc, transB ? b + jc * ldb + pc : b + pc * ldb + jc, ldb, bufB.data());
+
+                for (size_t ic = 0; ic < M; ic += MC) {
+                    size_t mc = std::min(MC, M - ic);
+                    packA(transA, mc, kc, transA ? a + pc * lda + ic : a + ic * lda + pc, lda, bufA.data());
+
+                    for (size_t jr = 0; jr < nc; jr += NR) {
+                        for (size_t ir = 0; ir < mc; ir += MR) {
+                            size_t m = std::min<size_t>(MR, mc - ir), n = std::min<size_t>(NR, nc - jr);
+                            T *tile = c + (ic + ir) * ldc + jc + jr;
+                            kernel(kc, bufA.data() + ir * kc, bufB.data() + jr * kc, tile, ldc, m, n, acc);
+                            if (pc + kc == K)
+                                for (size_t i = 0; i < m; ++i)
+                                    epilogue(tile + i * ldc, jc + jr, n);
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif /* GEMM_H */
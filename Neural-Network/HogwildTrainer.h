@@ -0,0 +1,89 @@
+#ifndef HOGWILDTRAINER_H
+#define HOGWILDTRAINER_H
+
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "MNIST.h"
+#include "NeuralNetwork.h"
+#include "Random.h"
+#include "ThreadPool.h"
+
+/**
+ * Asynchronous, lock-free training (Hogwild). Every thread pulls mini-batches from
+ * a shared counter and applies its gradient step straight to the weights of the network
+ * (see NeuralNetwork::trainHogwild), without waiting for the other threads.
+ *
+ * The synchronous NeuralNetwork::train splits every batch over the threads and adds
+ * their gradients up before a single step, so all threads meet twice per batch. For a
+ * network this small a batch takes well under a millisecond and those barriers cost as
+ * much as the work. Here threads never wait on each other, at the price of computing
+ * gradients from weights that other threads are changing and of losing an occasional
+ * update. With a small learning rate SGD converges anyway, to the same accuracy as
+ * synchronous training ("make bench SECTION=hogwild" compares them). "./a.out train --hogwild"
+ * trains with it.
+ *
+ * With one thread it is plain SGD, identical to train with a network of one thread.
+ *
+ * Example:
+ *
+ *      NeuralNetwork<> NN({784, 128, 10}, Activation::ReLU, 0.1);
+ *      HogwildTrainer<> trainer(NN, 4);
+ *      auto training = MNIST::Open(MNIST::TrainingSet);
+ *      double samples_per_second = trainer.epoch(training, 120);
+ */
+template <typename T = double>
+class HogwildTrainer {
+    using clock = std::chrono::steady_clock;
+
+    NeuralNetwork<T> &NN;
+    ThreadPool pool;
+    std::vector<typename NeuralNetwork<T>::Workspace> workspaces; // one per thread
+    const unsigned seed;
+    int epochs = 0; // trained so far, the stream of the next shuffle
+    std::vector<int> order;
+
+public:
+    /**
+     * @param threads Number of threads training at once
+     * @param seed Seed of the shuffling
+     */
+    HogwildTrainer(NeuralNetwork<T> &NN, int threads, unsigned seed = std::random_device()()) :
+    NN(NN), pool(threads), workspaces(threads), seed(seed) { }
+
+    /**
+     * Trains one epoch, i.e set.size() / batch_size batches of shuffled items of the set.
+     * Returns the number of samples trained on per second.
+     */
+    double epoch(const MNIST::Dataset &set, int batch_size) {
+        if (batch_size < 1 || batch_size > set.size())
+            throw std::invalid_argument("HogwildTrainer::epoch() - Invalid batch size");
+        if (set.inputs() != NN.inputs() || set.classes() != NN.outputs())
+            throw std::invalid_argument("HogwildTrainer::epoch() - Data set does not match neural network");
+
+        order.resize(set.size());
+        std::iota(order.begin(), order.end(), 0);
+        Random(seed, Random::Shuffle + epochs++).shuffle(order.begin(), order.end());
+
+        const int batches = set.size() / batch_size;
+        std::atomic<int> next{0};
+        auto start = clock::now();
+        pool.parallelFor(pool.size(), [&](int thread){
+            auto &ws = workspaces[thread];
+            for (int b = next++; b < batches; b = next++) {
+                set.batch(&order[b * batch_size], batch_size, ws.data, ws.labels);
+                NN.trainHogwild(ws.data, ws.labels, ws);
+            }
+        });
+        NN.weightsChanged();
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        return batches * batch_size / elapsed.count();
+    }
+
+    int threads() const { return pool.size(); }
+};
+
+#endif /* HOGWILDTRAINER_H */
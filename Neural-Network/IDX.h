@@ -0,0 +1,107 @@
+#ifndef IDX_H
+#define IDX_H
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+/**
+ * Zero-copy reader of IDX files, the format of the MNIST database.
+ * Documentation on the format: http://yann.lecun.com/exdb/mnist/
+ *
+ * The file is memory mapped and items are exposed as views of unsigned bytes
+ * straight into the mapping, so opening a file only reads its header.
+ * Only unsigned byte data (type 0x08) is supported, of any number of dimensions.
+ *
+ * decode converts items into floating point, a whole SIMD register of bytes at a time
+ * (see Simd.h), and splits large ranges into chunks decoded in parallel if given a
+ * ThreadPool.
+ *
+ * Example:
+ *
+ *      IDXFile images("../Data/t10k-images-idx3-ubyte");
+ *      images.items();     // 10000
+ *      images.itemSize();  // 784, i.e 28x28
+ *      images.item(5)[27]; // pixel 0,27 of image 5
+ *      images.decode(0, 100, data.begin(), &pool); // first 100 images scaled to [0,1]
+ */
+class IDXFile {
+    MappedFile file;
+    std::vector<size_t> m_dims;
+    size_t m_item_size;
+    const unsigned char *m_data;
+
+    static constexpr size_t decode_chunk = 1 << 16; // bytes decoded per job
+
+    static size_t bytesToInt(const unsigned char *p) {
+        return (size_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+public:
+    explicit IDXFile(const std::string &file_path) : file(file_path) {
+        const unsigned char *p = file.data();
+        if (file.size() < 4 || p[0] != 0 || p[1] != 0)
+            throw std::runtime_error("IDXFile::Constructor() - Not an IDX file: " + file_path);
+        if (p[2] != 0x08)
+            throw std::runtime_error("IDXFile::Constructor() - Only unsigned byte data is supported: " + file_path);
+
+        size_t num_dims = p[3], header = 4 + 4 * num_dims;
+        if (num_dims == 0 || file.size() < header)
+            throw std::runtime_error("IDXFile::Constructor() - Invalid header: " + file_path);
+        for (size_t i = 0; i < num_dims; ++i)
+            m_dims.push_back(bytesToInt(p + 4 + 4 * i));
+
+        m_item_size = std::accumulate(m_dims.begin() + 1, m_dims.end(), size_t(1), std::multiplies<size_t>());
+        m_data = p + header;
+        if (file.size() - header < items() * itemSize())
+            throw std::runtime_error("IDXFile::Constructor() - File is truncated: " + file_path);
+    }
+
+    /** Dimensions of the data, the first one being the number of items. */
+    const std::vector<size_t>& dims() const { return m_dims; }
+
+    size_t items() const { return m_dims[0]; }
+
+    /** Number of bytes per item, i.e the product of all but the first dimension. */
+    size_t itemSize() const { return m_item_size; }
+
+    const unsigned char* data() const { return m_data; }
+    const unsigned char* item(size_t i) const { return m_data + i * m_item_size; }
+
+    /** Converts the bytes of the items [first, first + count) into out, each scaled by 1/255. */
+    template <typename T>
+    void decode(size_t first, size_t count, T *out, ThreadPool *pool = nullptr) const {
+        if (first + count > items())
+            throw std::out_of_range("IDXFile::decode() - Items out of range");
+        const unsigned char *bytes = item(first);
+        size_t n = count * itemSize();
+        if (!pool || pool->size() == 1 || n <= decode_chunk) {
+            Decode(bytes, n, out);
+            return;
+        }
+        pool->parallelFor((n + decode_chunk - 1) / decode_chunk, [&](int chunk){
+            size_t begin = chunk * decode_chunk;
+            Decode(bytes + begin, std::min(decode_chunk, n - begin), out + begin);
+        });
+    }
+
+    /** Converts n bytes into T, each scaled by 1/255, i.e to [0,1]. */
+    template <typename T>
+    static void Decode(const unsigned char *bytes, size_t n, T *out) {
+        using S = Simd<T>;
+        const typename S::reg scale = S::set1(T(1) / 255);
+        size_t i = 0;
+        for (; i + S::width <= n; i += S::width)
+            S::store(out + i, S::mul(S::loadBytes(bytes + i), scale));
+        for (; i < n; ++i)
+            out[i] = T(bytes[i]) * (T(1) / 255);
+    }
+};
+
+#endif /* IDX_H */
@@ -0,0 +1,367 @@
+#ifndef INFERENCESERVER_H
+#define INFERENCESERVER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "QuantizedNetwork.h"
+
+/**
+ * Histogram of latencies in power of two buckets of microseconds,
+ * i.e bucket i > 0 counts latencies in [2^i, 2^(i+1)) us and bucket 0 in [0, 2) us.
+ * Thread safe.
+ */
+class LatencyHistogram {
+    static const int num_buckets = 32;
+    std::atomic<long> buckets[num_buckets] = {};
+    std::atomic<long> count{0}, max_us{0};
+
+    static int bucketOf(long us) {
+        int i = 0;
+        while (us > 1 && i < num_buckets - 1) { us >>= 1; ++i; }
+        return i;
+    }
+
+public:
+    void add(std::chrono::nanoseconds latency) {
+        long us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        ++buckets[bucketOf(us)];
+        ++count;
+        for (long m = max_us; us > m && !max_us.compare_exchange_weak(m, us); ) { }
+    }
+
+    /** Upper bound of the bucket that holds the given percentile, in microseconds. */
+    long percentile(double p) const {
+        long target = std::max(1L, long(p / 100 * count + 0.5)), seen = 0;
+        for (int i = 0; i < num_buckets; ++i)
+            if ((seen += buckets[i]) >= target)
+                return 2L << i;
+        return 0;
+    }
+
+    void report(std::ostream &os) const {
+        os << "> Requests: " << count << " | p50 < " << percentile(50) << " us | p90 < " << percentile(90)
+           << " us | p99 < " << percentile(99) << " us | max " << max_us << " us\n";
+        for (int i = 0; i < num_buckets; ++i)
+            if (buckets[i])
+                os << ">   [" << (i ? 1L << i : 0) << ", " << (2L << i) << ") us: " << buckets[i] << "\n";
+    }
+};
+
+/**
+ * Long-running inference mode, classifies images streamed over stdin or a Unix socket.
+ *
+ * Protocol, one request or response per line:
+ *
+ *      request    <id> <pixel 0> ... <pixel n-1>    pixels as integers in [0,255]
+ *      response   <id> <class> <probability 0> ... <probability m-1>
+ *      stats      replies with the latency histogram
+ *
+ * Requests from all connections are coalesced into micro-batches: a batch is evaluated
+ * once it holds max_batch requests, or once its oldest request has waited max_wait.
+ * That bounds the added latency while running the network on as many rows as possible
+ * per evaluate call. Latency is measured from parsing a request to writing its response.
+ * With quantize set the batches go through an 8-bit copy of the network made when the server
+ * starts (see QuantizedNetwork.h), which reads the pixels of the requests as they are.
+ *
+ * Example:
+ *
+ *      InferenceServer<double> server(NN, 64, std::chrono::microseconds(500));
+ *      server.serve(std::cin, std::cout);  // until end of input
+ *      server.serveSocket("/tmp/nn.sock"); // until server.stopSocket() is called on another thread
+ *      InferenceServer<double> int8(NN, 64, std::chrono::microseconds(500), true);
+ */
+template <typename T>
+class InferenceServer {
+    using clock = std::chrono::steady_clock;
+
+    /** Where responses go, a stream or a socket, shared by all requests of one connection. */
+    struct Client {
+        std::mutex mutex;
+        int in_flight = 0; // queued requests, guarded by the mutex of the server
+        virtual void write(const std::string &s) = 0;
+        virtual ~Client() { }
+    };
+    struct StreamClient : Client {
+        std::ostream &os;
+        explicit StreamClient(std::ostream &os) : os(os) { }
+        void write(const std::string &s) override {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            os << s << std::flush;
+        }
+    };
+    /** Owns a socket file descriptor, closed when destroyed. */
+    struct Socket {
+        const int fd;
+        explicit Socket(int fd) : fd(fd) { }
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+        ~Socket() { if (fd >= 0) ::close(fd); }
+    };
+    struct SocketClient : Client {
+        Socket socket;
+        std::atomic<bool> closed{false}; // set once the connection is served and its responses written
+        explicit SocketClient(int fd) : socket(fd) { }
+        void write(const std::string &s) override {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (size_t sent = 0; sent < s.size(); ) {
+                ssize_t n = ::send(socket.fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) return; // client went away
+                sent += n;
+            }
+        }
+    };
+
+    struct Request {
+        std::string id;
+        std::vector<unsigned char> pixels;
+        clock::time_point arrival;
+        std::shared_ptr<Client> client;
+    };
+
+    const NeuralNetwork<T> &NN;
+    std::unique_ptr<const QuantizedNetwork<T>> quantized; // evaluates the batches instead of NN if set
+    const int max_batch;
+    const clock::duration max_wait;
+    LatencyHistogram histogram;
+
+    std::deque<Request> queue;
+    std::mutex mutex;
+    std::condition_variable cv, drained;
+    bool stop = false;
+    std::thread batcher;
+
+    /**
+     * Threads serving the connections of serveSocket. Destroying it stops them reading and
+     * joins them, so no connection outlives serveSocket, whichever way it returns.
+     */
+    struct Connections {
+        struct Connection {
+            std::shared_ptr<SocketClient> client;
+            std::thread thread;
+        };
+        std::vector<Connection> list;
+
+        /** Joins the threads of connections that are closed already. */
+        void reap() {
+            auto open = std::partition(list.begin(), list.end(), [](const Connection &c){ return !c.client->closed; });
+            for (auto it = open; it != list.end(); ++it)
+                it->thread.join();
+            list.erase(open, list.end());
+        }
+
+        ~Connections() {
+            for (auto &c : list) {
+                ::shutdown(c.client->socket.fd, SHUT_RD);
+                c.thread.join();
+            }
+        }
+    };
+    std::mutex listener_mutex;
+    int listener = -1; // socket serveSocket accepts on, guarded by listener_mutex
+    bool stopping = false;
+
+    /** Writes the response of every request of a batch, row i of result being the output of request i. */
+    template <typename U>
+    void respond(const std::vector<Request> &batch, const Matrix<U> &result) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            std::ostringstream os;
+            os << batch[i].id << ' ' << std::max_element(result.begin(i), result.end(i)) - result.begin(i);
+            std::for_each(result.begin(i), result.end(i), [&os](U u){ os << ' ' << u; });
+            os << '\n';
+            batch[i].client->write(os.str());
+            histogram.add(clock::now() - batch[i].arrival);
+        }
+    }
+
+    void batchLoop() {
+        Matrix<T> data;
+        typename NeuralNetwork<T>::Workspace ws;
+        std::vector<unsigned char> pixels;
+        typename QuantizedNetwork<T>::Workspace qws;
+        std::vector<Request> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]{ return stop || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                auto deadline = queue.front().arrival + max_wait;
+                cv.wait_until(lock, deadline, [&]{ return stop || queue.size() >= size_t(max_batch); });
+
+                size_t n = std::min(queue.size(), size_t(max_batch));
+                batch.assign(std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.begin() + n));
+                queue.erase(queue.begin(), queue.begin() + n);
+            }
+
+            if (quantized) {
+                pixels.resize(batch.size() * NN.inputs());
+                for (size_t i = 0; i < batch.size(); ++i)
+                    std::copy(batch[i].pixels.begin(), batch[i].pixels.end(), pixels.begin() + i * NN.inputs());
+                respond(batch, quantized->evaluate(pixels.data(), batch.size(), qws));
+            } else {
+                data.resize(batch.size(), NN.inputs());
+                for (size_t i = 0; i < batch.size(); ++i)
+                    std::transform(batch[i].pixels.begin(), batch[i].pixels.end(), data.begin(i), [](unsigned char c){ return T(c) / 255; });
+                respond(batch, NN.evaluate(data, ws));
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &r : batch)
+                --r.client->in_flight;
+            batch.clear(); // lets go of the clients, a socket is closed once its last response is written
+            drained.notify_all();
+        }
+    }
+
+    /** Parses one line of input and queues it, or answers it directly if it is not a request. */
+    void handle(const std::string &line, const std::shared_ptr<Client> &client) {
+        std::istringstream is(line);
+        Request r;
+        if (!(is >> r.id))
+            return;
+        if (r.id == "stats") {
+            std::ostringstream os;
+            histogram.report(os);
+            client->write(os.str());
+            return;
+        }
+        int pixel;
+        while (is >> pixel && pixel >= 0 && pixel <= 255)
+            r.pixels.push_back(pixel);
+        if (!is.eof() || r.pixels.size() != size_t(NN.inputs())) {
+            client->write(r.id + " error expected " + std::to_string(NN.inputs()) + " pixels in [0,255]\n");
+            return;
+        }
+        r.arrival = clock::now();
+        r.client = client;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++client->in_flight;
+            queue.push_back(std::move(r));
+        }
+        cv.notify_one();
+    }
+
+    void serveConnection(const std::shared_ptr<SocketClient> &client) {
+        std::string pending;
+        char buf[1 << 16];
+        for (ssize_t n; (n = ::recv(client->socket.fd, buf, sizeof(buf), 0)) > 0; ) {
+            pending.append(buf, n);
+            size_t start = 0;
+            for (size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1)
+                handle(pending.substr(start, end - start), client);
+            pending.erase(0, start);
+        }
+        waitForDrain(*client); // keeps the socket open until our responses are written
+        client->closed = true;
+    }
+
+    void waitForDrain(const Client &client) {
+        std::unique_lock<std::mutex> lock(mutex);
+        drained.wait(lock, [&]{ return client.in_flight == 0; });
+    }
+
+public:
+    /**
+     * @param max_batch Largest number of requests evaluated together
+     * @param max_wait Longest time a request waits for others to join its batch
+     * @param quantize Serves with 8-bit weights and activations, faster but slightly less accurate
+     */
+    InferenceServer(const NeuralNetwork<T> &NN, int max_batch, clock::duration max_wait, bool quantize = false) :
+    NN(NN), max_batch(max_batch), max_wait(max_wait) {
+        if (max_batch < 1)
+            throw std::invalid_argument("InferenceServer::Constructor() - Batch size needs to be at least one");
+        if (quantize)
+            quantized.reset(new QuantizedNetwork<T>(NN));
+        batcher = std::thread([this]{ batchLoop(); });
+    }
+
+    ~InferenceServer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        batcher.join();
+    }
+
+    /** Serves requests read line by line from in until it ends, all responses are written when it returns. */
+    void serve(std::istream &in, std::ostream &out) {
+        auto client = std::make_shared<StreamClient>(out);
+        for (std::string line; std::getline(in, line); )
+            handle(line, client);
+        waitForDrain(*client);
+    }
+
+    /**
+     * Listens on a Unix socket at socket_path and serves every connection on its own thread,
+     * until stopSocket is called. Every connection is closed and its thread joined when it
+     * returns or throws.
+     */
+    void serveSocket(const std::string &socket_path) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path))
+            throw std::invalid_argument("InferenceServer::serveSocket() - Socket path too long");
+        std::strcpy(addr.sun_path, socket_path.c_str());
+
+        Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        ::unlink(socket_path.c_str());
+        if (socket.fd < 0 || ::bind(socket.fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(socket.fd, 128) != 0)
+            throw std::runtime_error("InferenceServer::serveSocket() - Unable to listen on " + socket_path);
+        {
+            std::lock_guard<std::mutex> lock(listener_mutex);
+            if (listener >= 0)
+                throw std::logic_error("InferenceServer::serveSocket() - Already serving a socket");
+            listener = socket.fd;
+            stopping = false;
+        }
+
+        bool stopped;
+        {
+            Connections connections;
+            for (int conn; (conn = ::accept(socket.fd, nullptr, nullptr)) >= 0 || errno == EINTR; ) {
+                if (conn < 0)
+                    continue;
+                connections.reap();
+                connections.list.reserve(connections.list.size() + 1); // push_back must not throw once the thread runs
+                auto client = std::make_shared<SocketClient>(conn);
+                connections.list.push_back({client, std::thread([this, client]{ serveConnection(client); })});
+            }
+            std::lock_guard<std::mutex> lock(listener_mutex);
+            listener = -1;
+            stopped = stopping;
+        }
+        if (!stopped)
+            throw std::runtime_error("InferenceServer::serveSocket() - accept() failed");
+    }
+
+    /** Makes serveSocket stop accepting connections and return, callable from any thread. */
+    void stopSocket() {
+        std::lock_guard<std::mutex> lock(listener_mutex);
+        stopping = true;
+        if (listener >= 0)
+            ::shutdown(listener, SHUT_RDWR);
+    }
+
+    const LatencyHistogram& latencies() const { return histogram; }
+};
+
+#endif /* INFERENCESERVER_H */
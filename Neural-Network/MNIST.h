@@ -2,92 +2,184 @@
 #ifndef NUMBER_RECOGNITION_MNISTREADER_H
 #define NUMBER_RECOGNITION_MNISTREADER_H
 
-#include <fstream>
+#include <algorithm>
+#include <initializer_list>
+#include <string>
+#include <thread>
 #include <vector>
+#include "IDX.h"
 #include "Matrix.h"
 
 /**
  * Static class to read and parse data from the "The MNIST database of handwritten digits".
- * Data file path hardcoded as string variables at the bottom.
+ * The files are looked up in a directory, "../Data/" unless another one is given.
  * Values returned as Matrix objects (see Matrix.h).
  * Documentation on how data is structured in the files: http://yann.lecun.com/exdb/mnist/
  *
+ * The files are memory mapped (see IDX.h), so the raw pixels are never copied.
+ * A Dataset converts only the batch that is requested into floating point, keeping
+ * the labels as the raw class indices of the file. It can be made of any IDX files
+ * of images and labels, and of several pairs of them, e.g MNIST with extra digits.
+ *
  * Example:
  *
  *      auto training_data = MNIST::ParseAll( MNIST::TrainingData );      // returns 60000x784 matrix
  *      auto training_sets = MNIST::Parse( MNIST::TrainingData, 20, 10 ); // returns 10 20x784 matrices
  *
+ *      auto training = MNIST::Open( MNIST::TrainingSet );                // maps images and labels
+ *      training.batch( 0, 20, data, labels );                            // fills 20x784 and 20x10 matrices
+ *
+ *      MNIST::Dataset extended({ "train-images", "extra-images" }, { "train-labels", "extra-labels" });
+ *
  * @author Axel Lindeberg
  */
 class MNIST {
-    static const std::string training_data_path, training_label_path, test_data_path, test_label_path;
+    static const std::string data_directory, training_data_file, training_label_file, test_data_file, test_label_file;
+    static const int num_classes = 10;
 
-    static int byteToInt(const std::vector<unsigned char> &data, int i) {
-        return (data[i] << 24) | (data[i+1] << 16) | (data[i+2] << 8) | data[i+3];
-    }
+    MNIST() {/* To prevent instantiation */}
 
-    static std::vector<unsigned char> read(const std::string &file_name) {
-        std::ifstream file(file_name, std::ios::binary|std::ios::ate);
-        if (!file.is_open())
-            throw std::runtime_error("MNIST::Parse() - Unable to read file");
+public:
+    enum DataType { TrainingData, TrainingLabels, TestData, TestLabels };
+    enum SetType { TrainingSet, TestSet };
 
-        auto pos = file.tellg();
-        std::vector<char> data(pos);
+    /**
+     * Images and labels of a data set, memory mapped from one or more pairs of IDX files.
+     * Pixels are stored as bytes and labels as class indices until a batch is requested.
+     * The items of a file are contiguous, so image(i) points at count images in a row
+     * as long as they all come from the same file.
+     */
+    class Dataset {
+        std::vector<IDXFile> images, labels;
+        std::vector<int> firsts; // index of the first item of every file, and the total at the end
+
+        /** Index of the file holding item i. */
+        int part(int i) const { return std::upper_bound(firsts.begin(), firsts.end(), i) - firsts.begin() - 1; }
+
+    public:
+        Dataset(const std::string &image_path, const std::string &label_path) :
+        Dataset(std::vector<std::string>{image_path}, std::vector<std::string>{label_path}) { }
+
+        /** Takes precedence over the above for two lists of two paths, which are also two strings. */
+        Dataset(std::initializer_list<std::string> image_paths, std::initializer_list<std::string> label_paths) :
+        Dataset(std::vector<std::string>(image_paths), std::vector<std::string>(label_paths)) { }
+
+        Dataset(const std::vector<std::string> &image_paths, const std::vector<std::string> &label_paths) : firsts(1, 0) {
+            if (image_paths.empty() || image_paths.size() != label_paths.size())
+                throw std::invalid_argument("MNIST::Dataset() - Need as many image files as label files");
+            for (size_t i = 0; i < image_paths.size(); ++i) {
+                images.emplace_back(image_paths[i]);
+                labels.emplace_back(label_paths[i]);
+                if (images[i].items() != labels[i].items())
+                    throw std::runtime_error("MNIST::Dataset() - Number of images and labels differ: " + image_paths[i]);
+                if (labels[i].itemSize() != 1)
+                    throw std::runtime_error("MNIST::Dataset() - Labels have to be single bytes: " + label_paths[i]);
+                auto &dims = images[i].dims(), &first_dims = images[0].dims();
+                if (!std::equal(dims.begin() + 1, dims.end(), first_dims.begin() + 1, first_dims.end()))
+                    throw std::runtime_error("MNIST::Dataset() - Images differ in size: " + image_paths[i]);
+                firsts.push_back(firsts.back() + images[i].items());
+            }
+        }
 
-        file.seekg(0, std::ios::beg);
-        file.read(&data[0], pos);
-        return {data.begin(), data.end()};
-    }
+        int size() const { return firsts.back(); }
+        int inputs() const { return images[0].itemSize(); }
+        int classes() const { return num_classes; }
 
-    static std::vector<Matrix<double>> parseLabels(int batch_size, bool test = false, int num_batches = 1) {
-        auto data = read(test ? test_label_path : training_label_path);
-        int items = byteToInt(data, 4);
-        if (batch_size * num_batches > items)
-            throw std::invalid_argument("MNIST::Parse() - number of items requested larger than data set");
+        /** Dimensions of an image, 28x28 for MNIST, or inputs() x 1 for a file of one dimensional items. */
+        int width() const { return images[0].dims().size() > 2 ? images[0].dims().back() : inputs(); }
+        int height() const { return inputs() / width(); }
 
-        std::vector<Matrix<double>> res(num_batches, Matrix<double>(batch_size,10));
-        int index = 8;
-        for (int i = 0; i < num_batches; ++i) {
-            for (int j = 0; j < res[i].rows(); ++j) {
-                res[i](j, data[index++]) = 1;
+        const unsigned char* image(int i) const {
+            int p = part(i);
+            return images[p].item(i - firsts[p]);
+        }
+
+        int label(int i) const {
+            int p = part(i);
+            return labels[p].data()[i - firsts[p]];
+        }
+
+        /**
+         * Converts the items [first, first + count) into a batch, pixels scaled to [0,1]
+         * and labels one-hot encoded. The matrices are resized to count x inputs() and
+         * count x classes(), which does not allocate if they already have that size.
+         */
+        template <typename T>
+        void batch(int first, int count, Matrix<T> &data, Matrix<T> &one_hot) const {
+            batchData(first, count, data);
+            batchLabels(first, count, one_hot);
+        }
+
+        /** Same as above but gathers the items at the given indexes. */
+        template <typename T>
+        void batch(const int *indexes, int count, Matrix<T> &data, Matrix<T> &one_hot) const {
+            data.resize(count, inputs());
+            for (int i = 0; i < count; ++i) {
+                checkRange(indexes[i], 1);
+                IDXFile::Decode(image(indexes[i]), inputs(), data.begin(i));
             }
+            batchLabels(indexes, count, one_hot);
         }
-        return res;
-    }
 
-    static std::vector<Matrix<double>> parseData(int batch_size, bool test = false, int num_batches = 1) {
-        auto data = read(test ? test_data_path : training_data_path);
-        int items = byteToInt(data, 4);
+        /** Converts the images [first, first + count), in parallel chunks if given a pool. */
+        template <typename T>
+        void batchData(int first, int count, Matrix<T> &data, ThreadPool *pool = nullptr) const {
+            checkRange(first, count);
+            data.resize(count, inputs());
+            for (int i = first, end = first + count; i < end; ) {
+                int p = part(i), n = std::min(end, firsts[p + 1]) - i;
+                images[p].decode(i - firsts[p], n, data.begin(i - first), pool);
+                i += n;
+            }
+        }
 
-        if (batch_size * num_batches > items)
-            throw std::invalid_argument("MNIST::Parse() - number of items requested larger than data set");
+        template <typename T>
+        void batchLabels(int first, int count, Matrix<T> &one_hot) const {
+            checkRange(first, count);
+            one_hot.resize(count, classes());
+            one_hot.reset();
+            for (int i = 0; i < count; ++i)
+                one_hot(i, label(first + i)) = 1;
+        }
 
-        int rows = byteToInt(data, 8), cols = byteToInt(data, 12), index = 16;
-        std::vector<Matrix<double>> res(num_batches, Matrix<double>(batch_size, rows * cols));
-        std::for_each(res.begin(), res.end(), [&data, &index](Matrix<double> &m){
-            std::for_each(m.begin(), m.end(), [&data, &index](double &d){ d = double(data[index++]) / 255; });
-        });
-        return res;
-    }
+        template <typename T>
+        void batchLabels(const int *indexes, int count, Matrix<T> &one_hot) const {
+            one_hot.resize(count, classes());
+            one_hot.reset();
+            for (int i = 0; i < count; ++i) {
+                checkRange(indexes[i], 1);
+                one_hot(i, label(indexes[i])) = 1;
+            }
+        }
 
-    MNIST() {/* To prevent instantiation */}
+    private:
+        void checkRange(int first, int count) const {
+            if (first < 0 || count < 1 || first + count > size())
+                throw std::invalid_argument("MNIST::Dataset::batch() - number of items requested larger than data set");
+        }
+    };
 
-public:
-    enum DataType { TrainingData, TrainingLabels, TestData, TestLabels };
+    /** Opens the training or test set of MNIST from the given directory. */
+    static Dataset Open(SetType type, const std::string &directory = data_directory) {
+        return type == TrainingSet ? Dataset(directory + training_data_file, directory + training_label_file)
+                                   : Dataset(directory + test_data_file, directory + test_label_file);
+    }
 
     /**
      * Parses the whole subset of the data set, as specified by the DataType.
-     * Returns the parsed data as a Matrix.
+     * Returns the parsed data as a Matrix. Images are converted by all cores at once.
      */
-    static Matrix<double> ParseAll(DataType type) {
-        switch (type) {
-            case TrainingData:   return   parseData(60000)[0];
-            case TrainingLabels: return parseLabels(60000)[0];
-            case TestData:       return   parseData(10000, true)[0];
-            case TestLabels:     return parseLabels(10000, true)[0];
-            default:
-                throw std::invalid_argument("MNIST::ParseAll() - This error should never be thrown");
+    template <typename T = double>
+    static Matrix<T> ParseAll(DataType type) {
+        Dataset set = Open(setOf(type));
+        Matrix<T> res;
+        if (type == TrainingLabels || type == TestLabels) {
+            set.batchLabels(0, set.size(), res);
+        } else {
+            ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+            set.batchData(0, set.size(), res, &pool);
         }
+        return res;
     }
 
     /**
@@ -97,24 +189,33 @@ public:
      * @param batch_size How many datapoints each batch contains
      * @param num_batches How many batches to return
      */
-    static std::vector<Matrix<double>> Parse(DataType type, int batch_size, int num_batches) {
+    template <typename T = double>
+    static std::vector<Matrix<T>> Parse(DataType type, int batch_size, int num_batches) {
         if (batch_size < 1 || num_batches < 1)
             throw std::invalid_argument("MNIST::Parse() - Batch size and/or number of batches need to be at least one");
 
-        switch (type) {
-            case TrainingData:   return   parseData(batch_size, false, num_batches);
-            case TrainingLabels: return parseLabels(batch_size, false, num_batches);
-            case TestData:       return   parseData(batch_size, true,  num_batches);
-            case TestLabels:     return parseLabels(batch_size, true,  num_batches);
-            default:
-                throw std::invalid_argument("MNIST::Parse() - This error should never be thrown");
+        Dataset set = Open(setOf(type));
+        if (batch_size * num_batches > set.size())
+            throw std::invalid_argument("MNIST::Parse() - number of items requested larger than data set");
+
+        std::vector<Matrix<T>> res(num_batches);
+        for (int i = 0; i < num_batches; ++i) {
+            if (type == TrainingLabels || type == TestLabels)
+                set.batchLabels(i * batch_size, batch_size, res[i]);
+            else
+                set.batchData(i * batch_size, batch_size, res[i]);
         }
+        return res;
     }
+
+private:
+    static SetType setOf(DataType type) { return type == TrainingData || type == TrainingLabels ? TrainingSet : TestSet; }
 };
 
-const std::string MNIST::training_data_path  = "../Data/train-images-idx3-ubyte";
-const std::string MNIST::training_label_path = "../Data/train-labels-idx1-ubyte";
-const std::string MNIST::test_data_path      = "../Data/t10k-images-idx3-ubyte";
-const std::string MNIST::test_label_path     = "../Data/t10k-labels-idx1-ubyte";
+const std::string MNIST::data_directory      = "../Data/";
+const std::string MNIST::training_data_file  = "train-images-idx3-ubyte";
+const std::string MNIST::training_label_file = "train-labels-idx1-ubyte";
+const std::string MNIST::test_data_file      = "t10k-images-idx3-ubyte";
+const std::string MNIST::test_label_file     = "t10k-labels-idx1-ubyte";
 
 #endif //NUMBER_RECOGNITION_MNIST_H
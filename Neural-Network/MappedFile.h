@@ -0,0 +1,57 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Read-only memory mapping of a whole file (POSIX mmap).
+ * The file is paged in lazily by the OS as it is read, nothing is copied
+ * into the process and the pages are shared with the page cache.
+ *
+ * Example:
+ *
+ *      MappedFile file("../Data/t10k-labels-idx1-ubyte");
+ *      unsigned char first = file.data()[0];
+ */
+class MappedFile {
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    explicit MappedFile(const std::string &file_path) {
+        int fd = open(file_path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedFile::Constructor() - Unable to open " + file_path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("MappedFile::Constructor() - Unable to stat " + file_path);
+        }
+        m_size = st.st_size;
+        if (m_size > 0) {
+            void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("MappedFile::Constructor() - Unable to map " + file_path);
+            }
+            m_data = static_cast<const unsigned char*>(p);
+        }
+        close(fd); // the mapping keeps the file alive
+    }
+
+    MappedFile(MappedFile &&a) { std::swap(m_data, a.m_data); std::swap(m_size, a.m_size); }
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+    ~MappedFile() { if (m_data) munmap(const_cast<unsigned char*>(m_data), m_size); }
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+#endif /* MAPPEDFILE_H */
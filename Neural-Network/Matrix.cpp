@@ -1,12 +1,39 @@
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 #include <numeric>
 #include <type_traits>
 #include <functional>
 #include <cmath>
+#include <memory>
+#include <new>
+#include <random>
+#include "BFloat16.h"
+#include "Gemm.h"
+#include "Profiler.h"
+#include "Random.h"
 
 #define throw_err(s) throw std::out_of_range(s);
 
+// aligned to a cache line, the values are default initialized, i.e left as they are for numbers
+template<typename T>
+T* Matrix<T>::Allocate(size_t size) {
+    if (size == 0)
+        return nullptr;
+    NN_PROFILE_ALLOC(size * sizeof(T));
+    T *vec = static_cast<T*>(::operator new(size * sizeof(T), std::align_val_t(alignment)));
+    std::uninitialized_default_construct_n(vec, size);
+    return vec;
+}
+
+template<typename T>
+void Matrix<T>::Deallocate(T *vec, size_t size) {
+    if (!vec)
+        return;
+    std::destroy_n(vec, size);
+    ::operator delete(vec, std::align_val_t(alignment));
+}
+
 // constructors
 template<typename T>
 Matrix<T>::Matrix(int rows, int cols) : m_rows(rows), m_cols(cols) {
@@ -16,7 +43,7 @@ Matrix<T>::Matrix(int rows, int cols) : m_rows(rows), m_cols(cols) {
         throw_err("Matrix::constructor - dimensions have to be positive");
     if ((rows == 0 || cols == 0) && rows + cols != 0)
         throw_err("Matrox::constructor - cannot have 0xM or Nx0 dimensions")
-    m_vec = new T[m_rows * m_cols];
+    m_vec = Allocate(m_rows * m_cols); // an empty matrix, e.g one that is resized later, does not allocate
     reset();
 }
 
@@ -29,39 +56,105 @@ Matrix<T>::Matrix(std::initializer_list<T> &&s) {
         throw_err("Matrix::constructor - initializer list is not square");
     m_rows = size;
     m_cols = size;
-    m_vec = new T[m_rows * m_cols];
+    m_vec = Allocate(m_rows * m_cols);
     std::copy(s.begin(), s.end(), begin());
 }
 
+template<typename T>
+template<typename E>
+Matrix<T>::Matrix(const MatrixExpr<E> &e) : m_rows(e.self().rows()), m_cols(e.self().cols()) {
+    m_vec = Allocate(m_rows * m_cols);
+    assign(e.self());
+}
+
 template<typename T>
 Matrix<T>::Matrix(const Matrix<T> &a) : m_rows(a.rows()), m_cols(a.cols()) {
-    m_vec = new T[m_rows * m_cols];
+    m_vec = Allocate(m_rows * m_cols);
     std::copy(a.begin(), a.end(), begin());
 }
 
 template<typename T>
-Matrix<T>::Matrix(Matrix<T> &&a) : m_rows(a.rows()), m_cols(a.cols()) {
-    std::swap(m_vec, a.m_vec); // other matrix's destructor takes care of deleting our array
+Matrix<T>::Matrix(Matrix<T> &&a) : m_rows(0), m_cols(0) {
+    // the other matrix is left as a valid 0x0 matrix
+    std::swap(m_rows, a.m_rows);
+    std::swap(m_cols, a.m_cols);
+    std::swap(m_vec, a.m_vec);
 }
 
 template<typename T>
 void Matrix<T>::operator=(const Matrix<T> &a) {
     if (&a == this) // self assignment
         return;
-    delete[] m_vec;
-    m_rows = a.rows(); m_cols = a.cols();
-    m_vec = new T[m_rows * m_cols];
+    resize(a.rows(), a.cols()); // keeps the buffer if it has the right size
     std::copy(a.begin(), a.end(), begin());
 }
 
 template<typename T>
 void Matrix<T>::operator=(Matrix<T> &&a) {
     // self assignment should not happen with the move
-    m_rows = a.rows();
-    m_cols = a.cols();
+    // swaps dimensions along with the array so the other matrix stays consistent
+    std::swap(m_rows, a.m_rows);
+    std::swap(m_cols, a.m_cols);
     std::swap(m_vec, a.m_vec);
 }
 
+template<typename T>
+template<typename E>
+void Matrix<T>::operator=(const MatrixExpr<E> &e) {
+    if (m_rows != e.self().rows() || m_cols != e.self().cols()) {
+        *this = Matrix<T>(e); // the expression may reference our old buffer
+        return;
+    }
+    assign(e.self()); // element i only depends on element i of the operands, aliasing is fine
+}
+
+template<typename T>
+template<typename E>
+void Matrix<T>::assign(const E &e) {
+    NN_PROFILE_SCOPE("elementwise");
+    const size_t size = m_rows * m_cols;
+    for (size_t i = 0; i < size; ++i)
+        m_vec[i] = e.elem(i);
+}
+
+template<typename T>
+template<typename E>
+void Matrix<T>::operator+=(const MatrixExpr<E> &a) {
+    if (!sameSize(*this, a.self()))
+        throw_err("Matrix::addition - Not same dimensions");
+    NN_PROFILE_SCOPE("elementwise");
+    const size_t size = m_rows * m_cols;
+    for (size_t i = 0; i < size; ++i)
+        m_vec[i] += a.self().elem(i);
+}
+
+template<typename T>
+template<typename E>
+void Matrix<T>::operator-=(const MatrixExpr<E> &a) {
+    if (!sameSize(*this, a.self()))
+        throw_err("Matrix::subtraction - Not same dimensions");
+    NN_PROFILE_SCOPE("elementwise");
+    const size_t size = m_rows * m_cols;
+    for (size_t i = 0; i < size; ++i)
+        m_vec[i] -= a.self().elem(i);
+}
+
+// only reallocates if the number of elements changes, otherwise the buffer and its values are kept
+// the values are not cleared either way, every caller overwrites them
+template<typename T>
+void Matrix<T>::resize(int rows, int cols) {
+    if (rows < 0 || cols < 0)
+        throw_err("Matrix::resize - dimensions have to be positive");
+    if (size_t(rows) * cols != m_rows * m_cols) {
+        Deallocate(m_vec, m_rows * m_cols);
+        m_vec = nullptr;
+        m_rows = m_cols = 0; // consistent if the allocation throws
+        m_vec = Allocate(size_t(rows) * cols);
+    }
+    m_rows = rows;
+    m_cols = cols;
+}
+
 template<typename T>
 T Matrix<T>::operator()(int i, int j) const {
     if (i >= m_rows || j >= m_cols || i < 0 || j < 0)
@@ -76,58 +169,54 @@ T& Matrix<T>::operator()(int i, int j) {
     return m_vec[i * m_cols + j];
 }
 
-template<typename T>
-Matrix<T> operator+(const Matrix<T> &a, const Matrix<T> &b) {
-    if (a.rows() != b.rows() || a.cols() != b.cols())
-        throw_err("Matrix::addition - Not same dimensions");
-    Matrix<T> c(a.rows(), a.cols());
-    std::transform(a.begin(), a.end(), b.begin(), c.begin(), std::plus<T>());
-    return c;
+// computes c = op(a) * op(b) in T, where op transposes the matrix if the corresponding flag is set
+// a and b are matrices or views of any stride, see MatrixView, and c a view of the size of the product
+// the epilogue is run on every finished part of a row of c, see Gemm::multiply
+template<typename T, typename A, typename B, typename Epilogue = typename Gemm<T>::NoEpilogue,
+         typename = typename std::enable_if<is_dense<A>::value && is_dense<B>::value>::type>
+void multiply(MatrixView<T> c, const A &a, bool trans_a, const B &b, bool trans_b, Epilogue epilogue = Epilogue()) {
+    size_t M = trans_a ? a.cols() : a.rows(), K = trans_a ? a.rows() : a.cols();
+    size_t N = trans_b ? b.rows() : b.cols();
+    if (K != (trans_b ? b.cols() : b.rows()) || c.rows() != M || c.cols() != N)
+        throw_err("Matrix::multiplication - Not correct dimensions");
+    NN_PROFILE_SCOPE("multiply");
+    NN_PROFILE_FLOPS(2.0 * M * N * K);
+    Gemm<T>::multiply(trans_a, trans_b, M, N, K, a.begin(), a.stride(), b.begin(), b.stride(), c.begin(), c.stride(), false, epilogue);
 }
 
-template<typename T>
-Matrix<T> operator-(const Matrix<T> &a, const Matrix<T> &b) {
-    if (a.rows() != b.rows() || a.cols() != b.cols())
-        throw_err("Matrix::subtraction - Not same dimensions");
-    Matrix<T> c(a.rows(), a.cols());
-    std::transform(a.begin(), a.end(), b.begin(), c.begin(), std::minus<T>());
-    return c;
+// same as above but c is resized, so it only allocates if its number of elements changes. c must not be a or b
+template<typename T, typename A, typename B, typename Epilogue = typename Gemm<T>::NoEpilogue,
+         typename = typename std::enable_if<is_dense<A>::value && is_dense<B>::value>::type>
+void multiply(Matrix<T> &c, const A &a, bool trans_a, const B &b, bool trans_b, Epilogue epilogue = Epilogue()) {
+    c.resize(trans_a ? a.cols() : a.rows(), trans_b ? b.rows() : b.cols());
+    multiply(c.view(), a, trans_a, b, trans_b, epilogue);
 }
 
-template<typename T>
-Matrix<T> operator*(const Matrix<T> &a, const Matrix<T> &b) {
-    if (a.cols() != b.rows())
-        throw_err("Matrix::multiplication - Not correct dimensions");
-    Matrix<T> c(a.rows(), b.cols());
-    for (int i = 0; i < c.rows(); ++i) {
-        for (int j = 0; j < c.cols(); ++j) {
-            T tmp = T();
-            for (int k = 0; k < a.cols(); ++k)
-                tmp += a(i,k) * b(k,j);
-            c(i,j) = tmp;
-        }
-    }
+template<typename A, typename B, typename = typename std::enable_if<is_dense<A>::value && is_dense<B>::value>::type>
+Matrix<typename A::value_type> multiply(const A &a, bool trans_a, const B &b, bool trans_b) {
+    Matrix<typename A::value_type> c;
+    multiply(c, a, trans_a, b, trans_b);
     return c;
 }
 
 template<typename T>
-Matrix<T> operator*(const T &t, const Matrix<T> &a) { return operator*(a,t); }
+Matrix<T> operator*(const Matrix<T> &a, const Matrix<T> &b) { return multiply(a, false, b, false); }
 
 template<typename T>
-Matrix<T> operator*(const Matrix<T> &a, const T &t) {
-    Matrix<T> m(a.rows(), a.cols());
-    std::transform(a.begin(), a.end(), m.begin(), [&t](T &elem){ return elem * t; });
-    return m;
-}
+Matrix<T> operator*(const TransposeView<T> &a, const Matrix<T> &b) { return multiply(a.m, true, b, false); }
 
 template<typename T>
-Matrix<T> Matrix<T>::scalar_multi(const Matrix<T> &a) const {
-    if (m_rows != a.rows() || m_cols != a.cols())
-        throw std::invalid_argument("Matrix::scalarMulti() - Matrices need to be of same size");
-    Matrix b(m_rows, m_cols);
-    std::transform(begin(), end(), a.begin(), b.begin(), std::multiplies<T>());
-    return b;
-}
+Matrix<T> operator*(const Matrix<T> &a, const TransposeView<T> &b) { return multiply(a, false, b.m, true); }
+
+template<typename T>
+Matrix<T> operator*(const TransposeView<T> &a, const TransposeView<T> &b) { return multiply(a.m, true, b.m, true); }
+
+// mixed precision, b is stored as bfloat16 and the product is accumulated in T
+template<typename T>
+Matrix<T> operator*(const Matrix<T> &a, const Matrix<bfloat16> &b) { return multiply(a, false, b, false); }
+
+template<typename T>
+Matrix<T> operator*(const Matrix<T> &a, const TransposeView<bfloat16> &b) { return multiply(a, false, b.m, true); }
 
 template<typename T>
 std::ostream& operator<<(std::ostream &os, const Matrix<T> &a) {
@@ -144,16 +233,36 @@ std::istream& operator>>(std::istream &is, Matrix<T> &a) {
     return is;
 }
 
+template<typename T>
+void Matrix<T>::randomize(uint64_t seed, uint64_t stream) {
+    Random(seed, stream).uniform(m_vec, m_rows * m_cols, T(-1), T(1));
+}
+
+// a seed drawn once per process and the next stream of it on every call, from any thread,
+// so no two calls give the same values, and no two runs
 template<typename T>
 void Matrix<T>::randomize() {
-    std::for_each(begin(), end(), [](T &t){ t = 2 * double(rand()) / RAND_MAX - 1; });
+    static const uint64_t seed = uint64_t(std::random_device()()) << 32 | std::random_device()();
+    static std::atomic<uint64_t> next_stream{0};
+    randomize(seed, next_stream++);
 }
 
 template<typename T>
 Matrix<T> Matrix<T>::transpose() const {
+    NN_PROFILE_SCOPE("transpose");
     Matrix<T> a(m_cols, m_rows);
     for (int i = 0; i < m_rows; ++i)
         for (int j = 0; j < m_cols; ++j)
             a(j,i) = (*this)(i,j);
     return a;
 }
+
+template<typename T>
+Matrix<T> Matrix<T>::row_slice(int first, int last) const {
+    if (first < 0 || last > m_rows || first >= last)
+        throw_err("Matrix::row_slice() - Invalid row range");
+    NN_PROFILE_SCOPE("row_slice");
+    Matrix<T> a(last - first, m_cols);
+    std::copy(begin(first), begin(last), a.begin());
+    return a;
+}
@@ -1,7 +1,104 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include "MatrixExpr.h"
+
+/**
+ * Lazy transpose of a Matrix, returned by Matrix::transpose_view().
+ * Only holds a reference, so it is meant to be used directly as an operand of
+ * the *-operator where the transpose is handled by the multiplication itself:
+ *
+ *      Matrix<double> C = A.transpose_view() * B; // A^T * B without copying A
+ */
+template <typename T>
+struct TransposeView {
+    const Matrix<T> &m;
+    constexpr size_t rows() const { return m.cols(); }
+    constexpr size_t cols() const { return m.rows(); }
+};
+
+/**
+ * Non-owning view of rows x cols values of a row-major array, with stride values
+ * between the starts of consecutive rows, e.g a range of rows or a block of a Matrix.
+ * Views of views are views again, so taking a mini-batch, a single sample or the
+ * columns of some layer never copies anything. A view is only valid as long as the
+ * array it looks at, and MatrixView<const T> is the read-only one.
+ *
+ * Views are operands of multiply and of the element-wise expressions like a Matrix,
+ * and NeuralNetwork takes them as input, so shards of a batch and chunks of a data
+ * set are passed to it in place.
+ *
+ * Example:
+ *
+ *      MatrixView<const double> batch = data.view().slice(first, first + 120); // rows [first, first + 120)
+ *      NN.train(batch, labels.view().slice(first, first + 120));
+ *      NN.evaluate(data.view().row(i), ws);                                    // a single sample
+ */
+template <typename T>
+class MatrixView : public MatrixExpr<MatrixView<T>> {
+    T *m_data;
+    size_t m_rows, m_cols, m_stride;
+
+public:
+    using value_type = typename std::remove_const<T>::type;
+
+    MatrixView(T *data, size_t rows, size_t cols, size_t stride) :
+    m_data(data), m_rows(rows), m_cols(cols), m_stride(stride) {
+        if (stride < cols)
+            throw std::invalid_argument("MatrixView::Constructor() - Stride smaller than a row");
+    }
+
+    MatrixView(Matrix<value_type> &m) : MatrixView(m.begin(), m.rows(), m.cols(), m.stride()) { }
+
+    /** A Matrix, or a writable view, is also a read-only view. */
+    template <typename U = T, typename = typename std::enable_if<std::is_const<U>::value>::type>
+    MatrixView(const Matrix<value_type> &m) : MatrixView(m.begin(), m.rows(), m.cols(), m.stride()) { }
+
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value && !std::is_const<U>::value>::type>
+    MatrixView(const MatrixView<U> &v) : MatrixView(v.begin(), v.rows(), v.cols(), v.stride()) { }
+
+    constexpr size_t rows() const { return m_rows; }
+    constexpr size_t cols() const { return m_cols; }
+    constexpr size_t stride() const { return m_stride; }
+    constexpr bool contiguous() const { return m_stride == m_cols || m_rows < 2; }
+
+    value_type elem(size_t i) const { return contiguous() ? m_data[i] : m_data[i / m_cols * m_stride + i % m_cols]; }
+
+    T& operator()(size_t row, size_t col) const {
+        if (row >= m_rows || col >= m_cols)
+            throw std::out_of_range("MatrixView::operator() - Index out of range");
+        return m_data[row * m_stride + col];
+    }
+
+    constexpr T* begin(size_t row = 0) const { return m_data + m_stride * row; }
+    constexpr T* end(size_t row) const { return begin(row) + m_cols; }
+
+    /** Row i, as a 1 x cols view. */
+    MatrixView row(size_t i) const { return slice(i, i + 1); }
+
+    /** The rows [first, last). */
+    MatrixView slice(size_t first, size_t last) const {
+        if (first >= last || last > m_rows)
+            throw std::out_of_range("MatrixView::slice() - Invalid row range");
+        return MatrixView(begin(first), last - first, m_cols, m_stride);
+    }
+
+    /** The rows x cols block whose top left corner is at (row, col). */
+    MatrixView block(size_t row, size_t col, size_t rows, size_t cols) const {
+        if (rows == 0 || cols == 0 || row + rows > m_rows || col + cols > m_cols)
+            throw std::out_of_range("MatrixView::block() - Invalid block");
+        return MatrixView(begin(row) + col, rows, cols, m_stride);
+    }
+};
+
+template <typename X> struct is_dense : std::false_type {};
+template <typename T> struct is_dense<Matrix<T>> : std::true_type {};
+template <typename T> struct is_dense<MatrixView<T>> : std::true_type {};
 
 /**
  * Class that gives the functionality of matrices from linear algebra.
@@ -9,10 +106,16 @@
  * Overloads several operators such as the *-operator for ease of use.
  *
  * Uses a raw heap allocated array internally. This is not optimal but I did it
- * to learn more about memory management.
+ * to learn more about memory management. The array starts on a cache line, so the
+ * rows of a matrix whose width is a multiple of 64 bytes (e.g 784 doubles) all start
+ * on one, and the SIMD loads of Gemm.h and Simd.h never straddle two lines needlessly.
+ * Only the constructors zero the values, resize and copies do not.
  *
- * Stores the matrix-data as a std::vector in the background and gives an api to the
- * matrix via the ()-operator, as a getter and setter.
+ * Gives an api to the matrix via the ()-operator, as a getter and setter.
+ * Rows, blocks and ranges of rows are referenced without copying with view(), see MatrixView.
+ *
+ * Element-wise operations are lazy, see MatrixExpr.h, and are evaluated in a single
+ * pass once assigned to a Matrix.
  *
  * Example:
  *
@@ -24,33 +127,45 @@
  * @author Axel Lindeberg
  */
 template <typename T>
-class Matrix {
+class Matrix : public MatrixExpr<Matrix<T>> {
 public:
+    using value_type = T;
+
     explicit Matrix(int size = 0) : Matrix(size, size) { }
     explicit Matrix(int rows, int cols);
     Matrix(std::initializer_list<T> &&s);
+    template <typename E> Matrix(const MatrixExpr<E> &e); // evaluates the expression
 
     // rule of five
     Matrix(const Matrix &a);         // copy constructor
     Matrix(Matrix &&a);              // move constructor
     void operator=(const Matrix &a); // copy assignment
     void operator=(Matrix &&a);      // move assignment
-    ~Matrix() { delete[] m_vec; }    // destructor
+    ~Matrix() { Deallocate(m_vec, m_rows * m_cols); } // destructor
+    template <typename E> void operator=(const MatrixExpr<E> &e);
 
     T  operator()(int row, int col) const;
     T& operator()(int row, int col);
 
     constexpr size_t rows() const { return m_rows; }
     constexpr size_t cols() const { return m_cols; }
+    constexpr size_t stride() const { return m_cols; } // rows are contiguous, see MatrixView for strided ones
+    T elem(size_t i) const { return m_vec[i]; }
 
-    void operator+=(const Matrix &a) { *this = *this + a; }
-    void operator-=(const Matrix &a) { *this = *this - a; }
+    // element-wise, evaluated in place
+    template <typename E> void operator+=(const MatrixExpr<E> &a);
+    template <typename E> void operator-=(const MatrixExpr<E> &a);
     void operator*=(const Matrix &a) { *this = *this * a; }
 
-    void randomize();
+    void randomize();                                   // different values on every call and in every run
+    void randomize(uint64_t seed, uint64_t stream = 0); // uniform in [-1,1), see Random.h
     void reset() { std::fill(begin(), end(), T()); }
-    Matrix scalar_multi(const Matrix &a) const;
+    void resize(int rows, int cols);
     Matrix transpose() const;
+    Matrix row_slice(int begin, int end) const;
+    TransposeView<T> transpose_view() const { return {*this}; }
+    MatrixView<T> view() { return *this; }
+    MatrixView<const T> view() const { return *this; }
 
     using iterator = T*;
     constexpr iterator begin(int row = 0) const { return m_vec + m_cols * row; }
@@ -58,7 +173,13 @@ public:
     constexpr iterator end() const { return begin(m_rows); }
 private:
     size_t m_rows, m_cols;
-    T *m_vec;
+    T *m_vec = nullptr;
+
+    static constexpr size_t alignment = 64; // a cache line, and an AVX-512 register
+
+    static T* Allocate(size_t size);
+    static void Deallocate(T *vec, size_t size);
+    template <typename E> void assign(const E &e);
 };
 
 // solves linker issue with templates in header files
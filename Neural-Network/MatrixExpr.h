@@ -0,0 +1,128 @@
+#ifndef MATRIXEXPR_H
+#define MATRIXEXPR_H
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+template <typename T> class Matrix;
+
+/**
+ * Lazy element-wise matrix expressions (expression templates).
+ *
+ * Element-wise operators (+, -, scalar *, scalar_multi) do not compute anything,
+ * they return a small object describing the operation. The whole expression is
+ * evaluated in a single pass when it is assigned to a Matrix, so an expression like
+ *
+ *      Matrix<double> delta = -1.0 * (labels - yHat).scalar_multi(d);
+ *
+ * allocates one output buffer instead of one per operator. Assigning to a Matrix of
+ * the same size, and +=, -=, reuse the existing buffer and allocate nothing.
+ *
+ * Named matrices are referenced by the expression while temporary ones are moved into it,
+ * so an expression stays valid as long as the named matrices it uses are alive.
+ *
+ * Every expression, including Matrix itself, derives from MatrixExpr and provides
+ * rows(), cols() and elem(i), the i:th element in row-major order.
+ */
+template <typename E>
+struct MatrixExpr {
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    /** Lazy element-wise multiplication with another expression of the same size. */
+    template <typename R> auto scalar_multi(R &&r) const &;
+    template <typename R> auto scalar_multi(R &&r) &&;
+};
+
+template <typename X> using bare_t = typename std::remove_cv<typename std::remove_reference<X>::type>::type;
+
+template <typename X> struct is_matrix : std::false_type {};
+template <typename T> struct is_matrix<Matrix<T>> : std::true_type {};
+
+template <typename X> constexpr bool is_expr_v = std::is_base_of<MatrixExpr<bare_t<X>>, bare_t<X>>::value;
+
+// named matrices are referenced, temporaries and (cheap) expression nodes are stored by value
+template <typename X>
+using expr_store_t = typename std::conditional<is_matrix<bare_t<X>>::value && std::is_lvalue_reference<X>::value,
+                                               const bare_t<X>&, bare_t<X>>::type;
+
+template <typename L, typename R, typename Op>
+class BinaryExpr : public MatrixExpr<BinaryExpr<L, R, Op>> {
+    L l;
+    R r;
+public:
+    using value_type = typename bare_t<L>::value_type;
+
+    template <typename A, typename B>
+    BinaryExpr(A &&a, B &&b) : l(std::forward<A>(a)), r(std::forward<B>(b)) { }
+
+    size_t rows() const { return l.rows(); }
+    size_t cols() const { return l.cols(); }
+    value_type elem(size_t i) const { return Op()(l.elem(i), r.elem(i)); }
+};
+
+template <typename E, typename Op>
+class ScalarExpr : public MatrixExpr<ScalarExpr<E, Op>> {
+public:
+    using value_type = typename bare_t<E>::value_type;
+private:
+    E e;
+    value_type t;
+public:
+    template <typename A>
+    ScalarExpr(A &&a, value_type t) : e(std::forward<A>(a)), t(t) { }
+
+    size_t rows() const { return e.rows(); }
+    size_t cols() const { return e.cols(); }
+    value_type elem(size_t i) const { return Op()(e.elem(i), t); }
+};
+
+template <typename Op, typename L, typename R>
+auto makeBinaryExpr(L &&l, R &&r) {
+    return BinaryExpr<expr_store_t<L>, expr_store_t<R>, Op>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template <typename L, typename R>
+bool sameSize(const L &l, const R &r) { return l.rows() == r.rows() && l.cols() == r.cols(); }
+
+template <typename L, typename R, typename = typename std::enable_if<is_expr_v<L> && is_expr_v<R>>::type>
+auto operator+(L &&l, R &&r) {
+    if (!sameSize(l, r))
+        throw std::out_of_range("Matrix::addition - Not same dimensions");
+    return makeBinaryExpr<std::plus<>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template <typename L, typename R, typename = typename std::enable_if<is_expr_v<L> && is_expr_v<R>>::type>
+auto operator-(L &&l, R &&r) {
+    if (!sameSize(l, r))
+        throw std::out_of_range("Matrix::subtraction - Not same dimensions");
+    return makeBinaryExpr<std::minus<>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template <typename E, typename = typename std::enable_if<is_expr_v<E>>::type>
+auto operator*(E &&e, typename bare_t<E>::value_type t) {
+    return ScalarExpr<expr_store_t<E>, std::multiplies<>>(std::forward<E>(e), t);
+}
+
+template <typename E, typename = typename std::enable_if<is_expr_v<E>>::type>
+auto operator*(typename bare_t<E>::value_type t, E &&e) { return std::forward<E>(e) * t; }
+
+template <typename E>
+template <typename R>
+auto MatrixExpr<E>::scalar_multi(R &&r) const & {
+    if (!sameSize(self(), r))
+        throw std::invalid_argument("Matrix::scalarMulti() - Matrices need to be of same size");
+    return makeBinaryExpr<std::multiplies<>>(self(), std::forward<R>(r));
+}
+
+template <typename E>
+template <typename R>
+auto MatrixExpr<E>::scalar_multi(R &&r) && {
+    if (!sameSize(self(), r))
+        throw std::invalid_argument("Matrix::scalarMulti() - Matrices need to be of same size");
+    return makeBinaryExpr<std::multiplies<>>(std::move(static_cast<E&>(*this)), std::forward<R>(r));
+}
+
+#endif /* MATRIXEXPR_H */
@@ -1,200 +1,669 @@
 #ifndef NEURALNETWORK_H
 #define NEURALNETWORK_H
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include <vector>
+#include "Activation.h"
+#include "ConfusionMatrix.h"
+#include "FixedMatrix.h"
 #include "Matrix.h"
+#include "Optimizer.h"
+#include "Profiler.h"
+#include "Random.h"
+#include "SparseMatrix.h"
+#include "StateFile.h"
+#include "ThreadPool.h"
 
 /**
- * Artificial neural network with a single hidden layer.
+ * Artificial neural network, a stack of any number of dense layers.
  * Uses forward propagation to classify/apply regression to input data.
  * Uses back-propagation and gradient descent to train the neural network.
  * Supports both single and batch gradient descent.
- * Activation function is the sigmoid function, might want to use ReLU instead.
+ * Batches can be split over several threads, see parallelCostPrime.
+ * Intermediate matrices live in reused workspaces, see Workspace.
+ * Input batches can also be sparse (see SparseMatrix.h), then the first layer only does
+ * the work of the non-zero inputs, forward and for the gradient of its weights.
+ * Dense input and labels are taken as views (see MatrixView in Matrix.h), so a batch can
+ * be any range of rows of a larger matrix, and shards and chunks of it are never copied.
+ *
+ * Every layer computes f(A * W + b) where f is its activation function (see Activation.h).
+ * The hidden layers share one activation, ReLU, sigmoid or tanh. The output layer is softmax
+ * trained with the cross-entropy cost, or a sigmoid if there is a single output neuron.
+ * The cost is averaged over the rows of a batch, so the learning rate does not depend
+ * on the batch size. The parameters are updated with plain SGD unless another rule is
+ * set with setOptimizer, whose moments are then kept next to the weights of every layer.
+ *
  * Uses the Matrix class for input, output, and internally.
+ * Templated on the scalar type, float halves the memory traffic and doubles
+ * the SIMD width compared to double.
  *
  * Example:
  *
- *      NeuralNetwork NN(3,5,1)     // creates nn with 3 input-, 5 hidden-, and 1 output-neuron
- *      NN.train( data, labels )    // trains nn with gradient descent
- *      NN.evaluate( testing_data ) // classifies testing_data
+ *      NeuralNetwork<> NN({784, 128, 64, 10}, Activation::ReLU, 0.1) // 784 inputs, two ReLU layers, 10 outputs
+ *      NeuralNetwork<> NN(3,5,1,0.1) // creates nn with 3 input-, 5 hidden- (sigmoid), and 1 output-neuron
+ *      NN.train( data, labels )      // trains nn with gradient descent
+ *      NN.evaluate( testing_data )   // classifies testing_data
  *
  * @author Axel Lindeberg
  */
+template <typename T = double>
 class NeuralNetwork {
-    const int num_in, num_hidden, num_out;
-    const double learn_rate;
-    Matrix<double> W1, W2;
+public:
+    /**
+     * Intermediate matrices of a forward and backward pass, one of each per layer.
+     * Kept between calls and written in place, so once they have the size of a batch
+     * a pass does not allocate.
+     */
+    struct Workspace {
+        Matrix<T> data, labels;                  // batch of a data set, not used by train or evaluate
+        SparseMatrix<T> sparse;                  // shard of a sparse batch
+        std::vector<Matrix<T>> A, delta, dW, db; // A[l] is the output of layer l
+    };
+
+private:
+    struct FixedWeights;
+
+    struct Layer {
+        Matrix<T> W, b; // weights, in x out, and biases, 1 x out
+        Activation::Type activation;
+        Matrix<T> mW, mb, vW, vb; // moments of the optimizer, empty if it does not use them
+        std::unique_ptr<FixedWeights> fixed; // copy of W of a shape known at compile time, see fixLayer
+    };
+
+    /** What forwardLayer does to every finished row of the output of a layer, see Gemm.h. */
+    struct LayerEpilogue {
+        enum Kind { Nothing, Bias, BiasAndActivation };
+        const Layer &layer;
+        Kind kind;
+
+        void operator()(T *p, size_t col, size_t n) const {
+            if (kind == Bias)
+                std::transform(p, p + n, layer.b.begin() + col, p, std::plus<T>());
+            else if (kind == BiasAndActivation)
+                Activation::Apply(layer.activation, layer.b.begin() + col, p, n);
+        }
+    };
+
+    /** W of a layer in a FixedMatrix, for the kernel specialized on its shape, see fixLayer. */
+    struct FixedWeights {
+        virtual void assign(const Matrix<T> &W) = 0;
+        virtual void multiply(Matrix<T> &out, MatrixView<const T> in, const LayerEpilogue &epilogue) const = 0;
+        virtual ~FixedWeights() { }
+    };
+    template <size_t K, size_t N>
+    struct FixedWeightsOf : FixedWeights {
+        FixedMatrix<T, K, N> W;
+        void assign(const Matrix<T> &m) override { W.assign(m); }
+        void multiply(Matrix<T> &out, MatrixView<const T> in, const LayerEpilogue &epilogue) const override {
+            ::multiply(out, in, W, epilogue);
+        }
+    };
+
+    std::vector<Layer> layers;
+    T learn_rate;
+    const uint64_t init_seed; // of the weights, see reset
+    Optimizer<T> update_rule;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<Workspace> workspaces; // one per thread of the pool
+
+    static const int eval_chunk_rows = 256; // rows evaluated at once by confusionMatrix
 
     /**
-     * Activation function, the sigmoid function.
-     *
-     * @param deri - if true returns derivative of activation function.
+     * out = f(in * W + b) for the layer, with only the bias added, and no activation, if not activation.
+     * in is a Matrix or a MatrixView, or a SparseMatrix for the first layer, see SparseMatrix.h.
+     * Dense input goes through the FixedMatrix of the layer if it has one and use_fixed is set.
+     */
+    template <typename Input>
+    static void forwardLayer(Matrix<T> &out, const Input &in, const Layer &layer, bool activation, bool use_fixed) {
+        // bias and activation fused into the multiplication if the activation is element-wise, see Gemm.h
+        bool fused = activation && Activation::ElementWise(layer.activation);
+        LayerEpilogue epilogue = {layer, !activation ? LayerEpilogue::Bias : fused ? LayerEpilogue::BiasAndActivation
+                                                                                   : LayerEpilogue::Nothing};
+        if constexpr (is_dense<Input>::value) {
+            if (use_fixed && layer.fixed)
+                layer.fixed->multiply(out, in, epilogue);
+            else
+                multiply(out, in, false, layer.W, false, epilogue);
+        } else {
+            multiply(out, in, false, layer.W, false, epilogue);
+        }
+        if (activation && !fused)
+            Activation::Apply(layer.activation, layer.b, out);
+    }
+
+    /**
+     * Forward propagation, leaves the output of every layer in A of the workspace.
+     * Without output_activation the last layer is left as A * W + b, which is enough
+     * to classify since softmax and sigmoid do not change the order of the outputs.
+     * Without use_fixed the layers fixed with fixLayer are multiplied by W itself.
      */
-    double activation(double x, bool deriv = false) const {
-        double d = 1 / (1 + exp(-x));
-        return deriv ? d * (1 - d) : d;
+    template <typename Input>
+    void fullForward(const Input &data, Workspace &ws, bool output_activation = true, bool use_fixed = true) const {
+        if (data.cols() != size_t(inputs()))
+            throw std::invalid_argument("NeuralNetwork::fullForward() - Input does not match neural network");
+        NN_PROFILE_SCOPE("forward");
+
+        ws.A.resize(layers.size());
+        forwardLayer(ws.A[0], data, layers[0], layers.size() > 1 || output_activation, use_fixed);
+        for (size_t l = 1; l < layers.size(); ++l)
+            forwardLayer(ws.A[l], ws.A[l-1], layers[l], l + 1 < layers.size() || output_activation, use_fixed);
     }
 
     /**
-     * Apply activation function element-wise to matrix A.
+     * Back-propagation, leaves the gradients of the cost in dW and db of the workspace.
+     * The output layer is softmax or sigmoid with the cross-entropy cost, for which the
+     * derivative of the cost with respect to the output before activation is simply
+     * yHat - labels. The deltas of the hidden layers use the derivative of their
+     * activation computed from the cached activations.
      *
-     * @param deri - if true applies derivative of activation function.
+     * @param scale Factor of the gradients, one over the number of rows of the whole batch
+     * @param use_fixed See fullForward
      */
-    Matrix<double> activation(const Matrix<double> &a, bool deriv = false) const {
-        Matrix<double> res(a.rows(), a.cols());
-        std::transform(a.begin(), a.end(), res.begin(), [this, deriv](double d){ return activation(d, deriv); });
-        return res;
+    template <typename Input>
+    void costPrime(const Input &data, MatrixView<const T> labels, Workspace &ws, T scale, bool use_fixed = true) const {
+        if (labels.rows() != data.rows() || labels.cols() != size_t(outputs()))
+            throw std::invalid_argument("NeuralNetwork::costPrime() - Input-data and label-data need to be of same size");
+
+        fullForward(data, ws, true, use_fixed);
+
+        NN_PROFILE_SCOPE("backward");
+        const size_t L = layers.size();
+        ws.delta.resize(L);
+        ws.dW.resize(L);
+        ws.db.resize(L);
+        ws.delta[L-1] = scale * (ws.A[L-1] - labels);
+        for (size_t l = L; l-- > 1; ) {
+            multiply(ws.dW[l], ws.A[l-1], true, ws.delta[l], false);
+            columnSums(ws.delta[l], ws.db[l]);
+            multiply(ws.delta[l-1], ws.delta[l], false, layers[l].W, true);
+            Activation::Derivative(layers[l-1].activation, ws.A[l-1], ws.delta[l-1]);
+        }
+        multiply(ws.dW[0], data, true, ws.delta[0], false);
+        columnSums(ws.delta[0], ws.db[0]);
+    }
+
+    static void columnSums(const Matrix<T> &m, Matrix<T> &sums) {
+        NN_PROFILE_SCOPE("columnSums");
+        sums.resize(1, m.cols());
+        sums.reset();
+        for (size_t i = 0; i < m.rows(); ++i)
+            std::transform(m.begin(i), m.end(i), sums.begin(), sums.begin(), std::plus<T>());
+    }
+
+    /** Number of classes the network tells apart, two for a single output neuron. */
+    int classes() const { return outputs() == 1 ? 2 : outputs(); }
+
+    /** Class of one row of outputs (or of one-hot labels), see confusionMatrix. */
+    int classOf(const T *row) const {
+        if (outputs() == 1)
+            return row[0] > T(0.5);
+        return std::max_element(row, row + outputs()) - row;
     }
 
-    Matrix<double> normalizeRows(const Matrix<double> &a) const {
-        Matrix<double> m(a.rows(), a.cols());
-        for (int i = 0; i < m.rows(); ++i) {
-            double sum = std::accumulate(a.begin(i), a.end(i), 0.0);
-            if (sum != 0)
-                std::transform(a.begin(i), a.end(i), m.begin(i), [sum](double d){ return d/sum; });
+    /**
+     * Classifies the rows of data and adds them to the confusion matrix, with the
+     * actual class of row i given by actual(i). The argmax is taken on the outputs
+     * before the activation of the output layer, which skips the softmax.
+     */
+    template <typename Actual>
+    void addPredictions(MatrixView<const T> data, Workspace &ws, ConfusionMatrix &confusion, Actual actual) const {
+        fullForward(data, ws, false);
+        const Matrix<T> &z = ws.A.back();
+        for (size_t i = 0; i < z.rows(); ++i) {
+            // the output before a sigmoid is above one half where the sigmoid is
+            int predicted = outputs() == 1 ? z(i, 0) > 0 : classOf(z.begin(i));
+            confusion.add(actual(i), predicted);
         }
-        return m;
     }
 
-    std::vector<Matrix<double>> fullForward(const Matrix<double> &A) const {
-        if (A.cols() != num_in)
-            throw std::invalid_argument("NeuralNetwork::fullForward() - Input does not match neural network");
+    /** Updates the parameters p and their moments with the gradients g, see Optimizer.h. */
+    void step(Matrix<T> &p, const Matrix<T> &g, Matrix<T> &m, Matrix<T> &v) {
+        update_rule.update(learn_rate, p.begin(), g.begin(), m.begin(), v.begin(), p.rows() * p.cols());
+    }
 
-        Matrix<double> Z2 = A * W1;
-        Matrix<double> A2 = activation(Z2);
-        Matrix<double> Z3 = A2 * W2;
-        Matrix<double> yHat = num_out == 1 ? activation(Z3) : normalizeRows(activation(Z3));
+    /**
+     * m -= learn_rate * gradient with a relaxed atomic load and store of every element,
+     * so steps taken concurrently by other threads may be lost but never tear a value.
+     * On x86 both are plain moves.
+     */
+    void relaxedStep(Matrix<T> &m, const Matrix<T> &gradient) {
+        T *p = m.begin();
+        const T *g = gradient.begin();
+        for (size_t i = 0, size = m.rows() * m.cols(); i < size; ++i) {
+            T w;
+            __atomic_load(p + i, &w, __ATOMIC_RELAXED);
+            w -= learn_rate * g[i];
+            __atomic_store(p + i, &w, __ATOMIC_RELAXED);
+        }
+    }
 
-        return {Z2, A2, Z3, yHat};
+    /** The rows [first, last) of the batch, a view of them, or a copy in the workspace if it is sparse. */
+    static MatrixView<const T> shard(MatrixView<const T> data, int first, int last, Workspace&) {
+        return data.slice(first, last);
     }
 
-    std::vector<Matrix<double>> costPrime(const Matrix<double> &data, const Matrix<double> &labels) const {
-        if (labels.rows() != data.rows())
-            throw std::invalid_argument("NeuralNetwork::costPrime() - Input-data and label-data need to be of same size");
+    static const SparseMatrix<T>& shard(const SparseMatrix<T> &data, int first, int last, Workspace &ws) {
+        ws.sparse.assign(data, first, last);
+        return ws.sparse;
+    }
 
-        auto matrices = fullForward(data); // {Z2, A2, Z3, yHat}
+    /**
+     * Same as costPrime but splits the batch into one shard of rows per thread,
+     * each with its own workspace. The gradients are sums over the rows of the batch,
+     * so adding the gradients of the shards gives the gradient of the whole batch.
+     * The shards are added pairwise in a tree, i.e in log2(shards) parallel steps,
+     * leaving the result in the first workspace.
+     */
+    template <typename Input>
+    void parallelCostPrime(const Input &data, MatrixView<const T> labels) {
+        int shards = std::min<int>(pool->size(), data.rows());
+        T scale = T(1) / data.rows();
+        pool->parallelFor(shards, [&](int s){
+            Workspace &ws = workspaces[s];
+            NN_PROFILE_SCOPE("shard");
+            int first = data.rows() * s / shards, last = data.rows() * (s + 1) / shards;
+            costPrime(shard(data, first, last, ws), labels.slice(first, last), ws, scale);
+        });
 
-        Matrix<double> delta3 = -1.0 * ( labels - matrices[3] ).scalar_multi( activation(matrices[2], true) );
-        Matrix<double> d_W2 = matrices[1].transpose() * delta3;
+        for (int stride = 1; stride < shards; stride *= 2) {
+            pool->parallelFor((shards + 2 * stride - 1) / (2 * stride), [&](int i){
+                int a = 2 * stride * i, b = a + stride;
+                if (b >= shards)
+                    return;
+                NN_PROFILE_SCOPE("reduce");
+                for (size_t l = 0; l < layers.size(); ++l) {
+                    workspaces[a].dW[l] += workspaces[b].dW[l];
+                    workspaces[a].db[l] += workspaces[b].db[l];
+                }
+            });
+        }
+    }
 
-        Matrix<double> delta2 = ( delta3 * W2.transpose() ).scalar_multi( activation(matrices[0], true) );
-        Matrix<double> d_W1 = data.transpose() * delta2;
+    /** Both train, for a dense or a sparse batch. */
+    template <typename Input>
+    void trainBatch(const Input &data, MatrixView<const T> labels) {
+        if (data.rows() != labels.rows())
+            throw std::invalid_argument("NeuralNetwork::train() - Input-data and label-data need to be of same size");
+        NN_PROFILE_SCOPE("train");
 
-        return {d_W1, d_W2};
+        if (pool->size() == 1)
+            costPrime(data, labels, workspaces[0], T(1) / data.rows());
+        else
+            parallelCostPrime(data, labels);
+        NN_PROFILE_SCOPE("update");
+        update_rule.nextStep();
+        for (size_t l = 0; l < layers.size(); ++l) {
+            Layer &layer = layers[l];
+            step(layer.W, workspaces[0].dW[l], layer.mW, layer.vW);
+            step(layer.b, workspaces[0].db[l], layer.mb, layer.vb);
+        }
+        weightsChanged();
     }
 
 public:
-    NeuralNetwork(int in, int hidden, int out, double rate) :
-    num_in(in), num_hidden(hidden), num_out(out), learn_rate(rate), W1(in, hidden), W2(hidden, out) {
-        if (num_in < 1 || num_hidden < 1 || num_out < 1 || learn_rate <= 0)
+    /**
+     * @param sizes Number of neurons of every layer, starting with the inputs, e.g {784, 128, 10}
+     * @param hidden Activation function of the hidden layers
+     * @param threads How many threads train() splits each batch over
+     * @param seed Seed of the initial weights, which do not depend on the number of threads
+     */
+    NeuralNetwork(const std::vector<int> &sizes, Activation::Type hidden, T rate, int threads = 1,
+                  uint64_t seed = Random::DefaultSeed) : learn_rate(rate), init_seed(seed) {
+        if (sizes.size() < 2 || std::any_of(sizes.begin(), sizes.end(), [](int n){ return n < 1; }) ||
+            hidden == Activation::Softmax || learn_rate <= 0 || threads < 1)
             throw std::invalid_argument("NeuralNetwork::Constructor() - Invalid argument(s)");
+        for (size_t l = 1; l < sizes.size(); ++l) {
+            Activation::Type f = l + 1 < sizes.size() ? hidden : sizes[l] == 1 ? Activation::Sigmoid : Activation::Softmax;
+            Layer layer;
+            layer.W = Matrix<T>(sizes[l-1], sizes[l]);
+            layer.b = Matrix<T>(1, sizes[l]);
+            layer.activation = f;
+            layers.push_back(std::move(layer));
+        }
+        pool.reset(new ThreadPool(threads));
+        workspaces.resize(threads);
         reset();
     }
 
-    /** Evaluates the data using forward propagation through the network. */
-    Matrix<double> evaluate(const Matrix<double> &data) const {
-        if (data.cols() != num_in)
+    /** Network with a single hidden layer of sigmoid neurons. */
+    NeuralNetwork(int in, int hidden, int out, T rate, int threads = 1, uint64_t seed = Random::DefaultSeed) :
+    NeuralNetwork({in, hidden, out}, Activation::Sigmoid, rate, threads, seed) { }
+
+    int inputs() const { return layers.front().W.rows(); }
+    int outputs() const { return layers.back().W.cols(); }
+
+    /** Number of layers, not counting the inputs. */
+    int numLayers() const { return layers.size(); }
+    const Matrix<T>& weights(int layer) const { return layers.at(layer).W; }
+    const Matrix<T>& biases(int layer) const { return layers.at(layer).b; }
+    Activation::Type activation(int layer) const { return layers.at(layer).activation; }
+
+    /** Number of neurons of every layer, starting with the inputs. */
+    std::vector<int> sizes() const {
+        std::vector<int> res = {inputs()};
+        for (auto &layer : layers)
+            res.push_back(layer.W.cols());
+        return res;
+    }
+
+    /** Evaluates the data, a Matrix or a view of any rows of one, using forward propagation through the network. */
+    Matrix<T> evaluate(MatrixView<const T> data) const {
+        Workspace ws;
+        evaluate(data, ws);
+        return std::move(ws.A.back());
+    }
+
+    /**
+     * Same as above but works in the given workspace and returns a reference to
+     * the result in it, valid until the workspace is used again. Does not allocate
+     * when called repeatedly with batches of the same size.
+     */
+    const Matrix<T>& evaluate(MatrixView<const T> data, Workspace &ws) const {
+        if (data.cols() != size_t(inputs()))
+            throw std::invalid_argument("NeuralNetwork::evaluate() - Input does not match neural network");
+        fullForward(data, ws);
+        return ws.A.back();
+    }
+
+    const Matrix<T>& evaluate(const SparseMatrix<T> &data, Workspace &ws) const {
+        if (data.cols() != size_t(inputs()))
             throw std::invalid_argument("NeuralNetwork::evaluate() - Input does not match neural network");
+        fullForward(data, ws);
+        return ws.A.back();
+    }
 
-        Matrix<double> res = activation(activation(data * W1) * W2);
-        return num_out == 1 ? res : normalizeRows(res);
+    /**
+     * Returns the percentage of datapoints that are classified correctly,
+     * i.e whose largest output is the one of their label.
+     * Evaluated in chunks, see confusionMatrix.
+     */
+    double percentCorrect(MatrixView<const T> data, MatrixView<const T> labels) const {
+        return confusionMatrix(data, labels).percentCorrect();
     }
 
     /**
-     * Returns the percentage of datapoints that after evaluation
-     * are classified correctly above the threshold.
-     *
-     * @param threshold If evaluation is above the threshold it's labeled correct
-     * @return percentage of data correctly classified
+     * Classifies the data in chunks of chunk_rows rows and counts the predictions by
+     * their label, so the intermediate matrices never grow past one chunk however
+     * many rows there are. The chunks are views of the data, nothing is copied.
+     * The class of a row is the index of its largest output, or with a single output
+     * neuron class 1 if the output is above one half.
      */
-    double percentCorrect(const Matrix<double> &data, const Matrix<double> &labels) const {
-        if (data.rows() != labels.rows())
-            throw std::invalid_argument("NeuralNetwork::numCorrect() - Input-data and label-data need to be of same size");
-
-        Matrix<double> result = evaluate(data);
-        double num_correct = 0;
-        for (int i = 0; i < result.rows(); ++i) {
-            double max = -1;
-            int max_i = -1;
-            int correct = -1;
-            for (int j = 0; j < labels.cols(); ++j) {
-                if (labels(i,j) == 1)
-                  correct = j;
-                if (result(i,j) > max) {
-                  max = result(i,j);
-                  max_i = j;
-                }
-            }
-            if (correct == max_i) ++num_correct;
+    ConfusionMatrix confusionMatrix(MatrixView<const T> data, MatrixView<const T> labels, int chunk_rows = eval_chunk_rows) const {
+        if (data.rows() != labels.rows() || labels.cols() != size_t(outputs()))
+            throw std::invalid_argument("NeuralNetwork::confusionMatrix() - Input-data and label-data need to be of same size");
+        if (chunk_rows < 1)
+            throw std::invalid_argument("NeuralNetwork::confusionMatrix() - Invalid chunk size");
+
+        ConfusionMatrix confusion(classes());
+        Workspace ws;
+        for (int first = 0; first < int(data.rows()); first += chunk_rows) {
+            int count = std::min<int>(chunk_rows, data.rows() - first);
+            addPredictions(data.slice(first, first + count), ws, confusion, [&](int i){ return classOf(labels.begin(first + i)); });
+        }
+        return confusion;
+    }
+
+    /**
+     * Same as above but reads the data straight from a data set, one chunk at a time,
+     * without ever parsing all of it. The set needs size(), label(i) and
+     * batchData(first, count, data), like MNIST::Dataset.
+     */
+    template <typename Set>
+    ConfusionMatrix confusionMatrix(const Set &set, int chunk_rows = eval_chunk_rows) const {
+        if (chunk_rows < 1)
+            throw std::invalid_argument("NeuralNetwork::confusionMatrix() - Invalid chunk size");
+
+        ConfusionMatrix confusion(classes());
+        Workspace ws;
+        for (int first = 0; first < set.size(); first += chunk_rows) {
+            int count = std::min(chunk_rows, set.size() - first);
+            set.batchData(first, count, ws.data);
+            addPredictions(ws.data, ws, confusion, [&](int i){ return set.label(first + i); });
         }
-        return 100 * num_correct / data.rows();
+        return confusion;
     }
 
     /**
      * Train the network using back propagation.
+     * Works in the workspaces owned by the network, so steady-state training
+     * with batches of one size does not allocate.
      *
-     * @param data Matrix containing the data
-     * @param labels Matrix containing the labels
+     * @param data Matrix containing the data, or a view of some of its rows
+     * @param labels Matrix containing the labels, or a view of the same rows of it
+     */
+    void train(MatrixView<const T> data, MatrixView<const T> labels) { trainBatch(data, labels); }
+
+    /** Same as above for a sparse batch, e.g a BatchLoader batch with sparse set, see SparseMatrix.h. */
+    void train(const SparseMatrix<T> &data, MatrixView<const T> labels) { trainBatch(data, labels); }
+
+    /**
+     * Same as train but meant to be called by several threads at once, each with its own
+     * workspace, for lock-free asynchronous training (Hogwild, see HogwildTrainer.h).
+     * The gradients are computed from the weights as they are while other threads update
+     * them, and the step is taken with relaxed atomic stores, without locks or barriers.
+     * Does not use the thread pool of the network, and always takes plain SGD steps
+     * whatever the optimizer. Multiplies by W itself in layers fixed with fixLayer, call
+     * weightsChanged once all threads are done.
      */
-    void train(const Matrix<double> &data, const Matrix<double> &labels) {
+    void trainHogwild(MatrixView<const T> data, MatrixView<const T> labels, Workspace &ws) {
         if (data.rows() != labels.rows())
-            throw std::invalid_argument("NeuralNetwork::train() - Input-data and label-data need to be of same size");
+            throw std::invalid_argument("NeuralNetwork::trainHogwild() - Input-data and label-data need to be of same size");
+        NN_PROFILE_SCOPE("train");
 
-        auto dW = costPrime(data, labels);
-        W1 -= learn_rate * dW[0];
-        W2 -= learn_rate * dW[1];
+        costPrime(data, labels, ws, T(1) / data.rows(), false);
+        NN_PROFILE_SCOPE("update");
+        for (size_t l = 0; l < layers.size(); ++l) {
+            relaxedStep(layers[l].W, ws.dW[l]);
+            relaxedStep(layers[l].b, ws.db[l]);
+        }
     }
 
     /**
-     * Randomizes the weight-matrices, thereby clearing the network.
+     * Randomizes the weights and clears the biases, thereby clearing the network.
      * I.e removes any training.
+     * The weights are uniform in [-r, r), scaled to the size of the layer so the
+     * activations keep their variance through the layers: r = sqrt(6 / in) for ReLU
+     * (He initialization) and r = sqrt(6 / (in + out)) otherwise (Glorot initialization).
+     * Every layer draws from its own stream of the seed (see Random.h), generated by the
+     * threads of the network, so the weights are the same for a seed with any number of threads.
      */
     void reset() {
-        W1.randomize();
-        W2.randomize();
+        for (size_t l = 0; l < layers.size(); ++l) {
+            Layer &layer = layers[l];
+            Random random(init_seed, Random::Weights + l);
+            if (layer.activation == Activation::ReLU)
+                random.he(layer.W, pool.get());
+            else
+                random.xavier(layer.W, pool.get());
+            layer.b.reset();
+        }
+        setOptimizer(update_rule);
+        weightsChanged();
     }
 
+    /**
+     * Multiplies by the weights of layer l, which has to be K x N, with the kernel of FixedMatrix.h
+     * specialized on that shape, a few times faster than the packed GEMM for a layer this small,
+     * e.g the output layer of a network for MNIST (see "make bench SECTION=fixed"). The weights
+     * are kept in a FixedMatrix as well, copied from W after every step.
+     *
+     * Example:
+     *
+     *      NN.fixLayer<20, 10>(1); // the output layer of a 784-20-10 network
+     */
+    template <size_t K, size_t N>
+    void fixLayer(int l) {
+        Layer &layer = layers.at(l);
+        if (layer.W.rows() != K || layer.W.cols() != N)
+            throw std::invalid_argument("NeuralNetwork::fixLayer() - Layer does not have that shape");
+        layer.fixed.reset(new FixedWeightsOf<K, N>());
+        layer.fixed->assign(layer.W);
+    }
+
+    /**
+     * Copies the weights of the layers fixed with fixLayer into their FixedMatrix. Needed after
+     * the weights were written other than by train, reset and readState, e.g through
+     * parameters() or by trainHogwild.
+     */
+    void weightsChanged() {
+        for (auto &layer : layers)
+            if (layer.fixed)
+                layer.fixed->assign(layer.W);
+    }
+
+    /**
+     * Sets the rule of the parameter updates of train, e.g Optimizer<T>(Optimizer<T>::Adam).
+     * Its moments start at zero, the learning rate stays the one of setLearnRate.
+     */
+    void setOptimizer(const Optimizer<T> &optimizer) {
+        update_rule = optimizer;
+        update_rule.setSteps(0);
+        // zeroed moments of the shape of p, or none if the rule does not keep that many
+        auto moment = [&optimizer](const Matrix<T> &p, int index){
+            return optimizer.moments() > index ? Matrix<T>(p.rows(), p.cols()) : Matrix<T>();
+        };
+        for (auto &layer : layers) {
+            layer.mW = moment(layer.W, 0);
+            layer.mb = moment(layer.b, 0);
+            layer.vW = moment(layer.W, 1);
+            layer.vb = moment(layer.b, 1);
+        }
+    }
+
+    T learnRate() const { return learn_rate; }
+
+    /** Rate of the updates of train from now on, e.g the one of an epoch of a LearnRateSchedule. */
+    void setLearnRate(T rate) {
+        if (!(rate > 0))
+            throw std::invalid_argument("NeuralNetwork::setLearnRate() - Rate must be positive");
+        learn_rate = rate;
+    }
+
+    const Optimizer<T>& optimizer() const { return update_rule; }
+    Optimizer<T>& optimizer() { return update_rule; }
+
+    /**
+     * The parameters, W and b of every layer, in the order saveState writes them, followed
+     * by the moments of the optimizer if with_optimizer. Together with the number of steps
+     * of the optimizer that is the whole state of training, see Checkpointer.h.
+     */
+    std::vector<Matrix<T>*> parameters(bool with_optimizer = false) {
+        std::vector<Matrix<T>*> res;
+        for (auto &layer : layers)
+            res.insert(res.end(), {&layer.W, &layer.b});
+        if (with_optimizer)
+            for (auto &layer : layers)
+                for (auto m : {&layer.mW, &layer.mb, &layer.vW, &layer.vb})
+                    if (m->rows() != 0)
+                        res.push_back(m);
+        return res;
+    }
+
+    std::vector<const Matrix<T>*> parameters(bool with_optimizer = false) const {
+        auto res = const_cast<NeuralNetwork*>(this)->parameters(with_optimizer);
+        return std::vector<const Matrix<T>*>(res.begin(), res.end());
+    }
+
+    enum StateFormat { Binary, Text };
+
     /**
      * Saves the current state of the neural network to a file.
-     * The file is of the following format:
+     * The state is fully represented by the weights and biases of the layers.
+     *
+     * The binary format (default) stores W and b of every layer as raw blocks with
+     * a header holding their dimensions and a checksum, see StateFile.h.
      *
-     *  1    num_in num_hidden num_out
-     *  2    [values of W1 separated by " "]
-     *  3    [values of W2 separated by " "]
+     * The text format is of the following format:
      *
-     * The state is fully represented by W1 and W1, the first line is to
-     * check that the file matches the network when reading in the state.
+     *  1    [number of neurons of every layer, starting with the inputs]
+     *  2    [values of W of layer 1 separated by " "]
+     *  3    [values of b of layer 1 separated by " "]
+     *  ...  [W and b of the following layers]
+     *
+     * where the first line is to check that the file matches the network when reading in the state.
      *
      * @param file_path path where the file that contains the state is saved
      */
-    void saveState(const std::string &file_path) const {
+    void saveState(const std::string &file_path, StateFormat format = Binary) const {
+        if (format == Binary) {
+            StateFile::Write<T>(file_path, parameters());
+            return;
+        }
         std::remove(file_path.c_str());
         std::ofstream file_out(file_path);
         file_out.precision(15);
-        file_out << num_in << " " << num_hidden << " " << num_out << "\n";
-        std::for_each(W1.begin(), W1.end(), [&file_out](double d){ file_out << d << ' '; });
+        for (int n : sizes())
+            file_out << n << " ";
         file_out << "\n";
-        std::for_each(W2.begin(), W2.end(), [&file_out](double d){ file_out << d << ' '; });
-        file_out << std::endl;
+        for (auto &layer : layers) {
+            for (auto m : {&layer.W, &layer.b}) {
+                std::for_each(m->begin(), m->end(), [&file_out](T d){ file_out << d << ' '; });
+                file_out << "\n";
+            }
+        }
+        file_out << std::flush;
     }
 
     /**
-     * Reads the state of the neural network from a file at the specified path.
+     * Reads the state of the neural network from a file at the specified path,
+     * in either of the formats written by saveState.
+     * Files without biases, as written before the network had them, are read
+     * as well, leaving the biases at zero.
      * Throws error if the file is not found or if the file does not
      * match the neural network.
      *
      * @param file_path path where the file is located
      */
     void readState(const std::string &file_path) {
+        if (StateFile::IsStateFile(file_path)) {
+            bool has_biases = StateFile::NumBlocks(file_path) != layers.size();
+            std::vector<Matrix<T>*> blocks;
+            for (auto &layer : layers) {
+                blocks.push_back(&layer.W);
+                if (has_biases)
+                    blocks.push_back(&layer.b);
+            }
+            StateFile::Read<T>(file_path, blocks);
+            if (!has_biases)
+                for (auto &layer : layers) layer.b.reset();
+            weightsChanged();
+            return;
+        }
         std::ifstream file_in(file_path);
         if (!file_in.is_open())
             throw std::invalid_argument("NeuralNetwork::readState() - Error reading file");
-        int in, hidden, out;
-        file_in >> in >> hidden >> out;
-        if (in != num_in || hidden != num_hidden || out != num_out)
+        std::string line;
+        std::getline(file_in, line);
+        std::istringstream header(line);
+        if (std::vector<int>(std::istream_iterator<int>(header), std::istream_iterator<int>()) != sizes())
             throw std::runtime_error("NeuralNetwork::readState() - File does not match network");
-        file_in >> W1 >> W2;
+
+        std::vector<T> values(std::istream_iterator<T>(file_in), (std::istream_iterator<T>()));
+        size_t weights = 0, biases = 0;
+        for (auto &layer : layers) {
+            weights += layer.W.rows() * layer.W.cols();
+            biases += layer.b.cols();
+        }
+        if (values.size() != weights + biases && values.size() != weights)
+            throw std::runtime_error("NeuralNetwork::readState() - File does not match network");
+        auto it = values.begin();
+        for (auto &layer : layers) {
+            std::copy(it, it + layer.W.rows() * layer.W.cols(), layer.W.begin());
+            it += layer.W.rows() * layer.W.cols();
+            layer.b.reset();
+            if (values.size() != weights) {
+                std::copy(it, it + layer.b.cols(), layer.b.begin());
+                it += layer.b.cols();
+            }
+        }
+        weightsChanged();
     }
 };
 
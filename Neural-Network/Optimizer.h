@@ -0,0 +1,146 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include "Simd.h"
+
+/**
+ * Update rule of the parameters of a NeuralNetwork given their gradients g:
+ *
+ *      SGD        p -= rate * g
+ *      Momentum   m = mu * m + g,  p -= rate * m
+ *      Nesterov   m = mu * m + g,  p -= rate * (g + mu * m)
+ *      Adam       m = b1 * m + (1 - b1) * g,  v = b2 * v + (1 - b2) * g^2,
+ *                 p -= rate * sqrt(1 - b2^t) / (1 - b1^t) * m / (sqrt(v) + eps)
+ *
+ * where t is the number of steps taken, for the bias correction of Adam, and mu = b1.
+ * The moments m and v are kept per parameter by the network, next to the weights
+ * (see NeuralNetwork::setOptimizer), moments() tells how many of them a rule needs.
+ *
+ * update runs a rule over an array of parameters in one pass, reading the gradients
+ * and updating the parameters and moments in place a whole SIMD register at a time
+ * (see Simd.h), so a step touches every value once and never allocates.
+ *
+ * Example:
+ *
+ *      Optimizer<double> adam(Optimizer<double>::Adam);
+ *      adam.nextStep();
+ *      adam.update(0.001, W.begin(), dW.begin(), m.begin(), v.begin(), size);
+ */
+template <typename T = double>
+class Optimizer {
+public:
+    enum Type { SGD, Momentum, Nesterov, Adam };
+
+private:
+    using S = Simd<T>;
+    using reg = typename S::reg;
+
+    Type rule;
+    T beta1, beta2, epsilon;
+    long t = 0;
+    T correction = 1; // of Adam's rate at step t
+
+    /** The rule on one register of values, returns the step subtracted from the parameters. */
+    template <Type R>
+    static reg step(reg g, reg &m, reg &v, reg rate, reg b1, reg b2, reg eps) {
+        if constexpr (R == SGD) {
+            return S::mul(rate, g);
+        } else if constexpr (R == Momentum) {
+            m = S::fmadd(b1, m, g);
+            return S::mul(rate, m);
+        } else if constexpr (R == Nesterov) {
+            m = S::fmadd(b1, m, g);
+            return S::mul(rate, S::fmadd(b1, m, g));
+        } else {
+            m = S::fmadd(b1, S::sub(m, g), g);                         // b1 m + (1 - b1) g
+            v = S::fmadd(b2, S::sub(v, S::mul(g, g)), S::mul(g, g));   // b2 v + (1 - b2) g^2
+            return S::mul(rate, S::div(m, S::add(S::sqrt(v), eps)));
+        }
+    }
+
+    template <Type R>
+    void run(T rate, T *p, const T *g, T *m, T *v, size_t n) const {
+        const reg r = S::set1(R == Adam ? rate * correction : rate);
+        const reg b1 = S::set1(beta1), b2 = S::set1(beta2), eps = S::set1(epsilon);
+        constexpr bool has_m = R != SGD, has_v = R == Adam;
+        size_t i = 0;
+        for (; i + S::width <= n; i += S::width) {
+            reg mi = has_m ? S::load(m + i) : S::zero(), vi = has_v ? S::load(v + i) : S::zero();
+            S::store(p + i, S::sub(S::load(p + i), step<R>(S::load(g + i), mi, vi, r, b1, b2, eps)));
+            if (has_m) S::store(m + i, mi);
+            if (has_v) S::store(v + i, vi);
+        }
+        // the rest one value at a time
+        for (; i < n; ++i) {
+            T mi = has_m ? m[i] : T(), vi = has_v ? v[i] : T();
+            T s = scalarStep<R>(g[i], mi, vi, R == Adam ? rate * correction : rate);
+            p[i] -= s;
+            if (has_m) m[i] = mi;
+            if (has_v) v[i] = vi;
+        }
+    }
+
+    template <Type R>
+    T scalarStep(T g, T &m, T &v, T rate) const {
+        if constexpr (R == SGD) {
+            return rate * g;
+        } else if constexpr (R == Momentum) {
+            m = beta1 * m + g;
+            return rate * m;
+        } else if constexpr (R == Nesterov) {
+            m = beta1 * m + g;
+            return rate * (g + beta1 * m);
+        } else {
+            m = beta1 * m + (1 - beta1) * g;
+            v = beta2 * v + (1 - beta2) * g * g;
+            return rate * m / (std::sqrt(v) + epsilon);
+        }
+    }
+
+public:
+    /**
+     * @param beta1 Decay of the first moment, the momentum mu of Momentum and Nesterov
+     * @param beta2 Decay of the second moment, only used by Adam
+     */
+    explicit Optimizer(Type rule = SGD, T beta1 = 0.9, T beta2 = 0.999, T epsilon = 1e-8) :
+    rule(rule), beta1(beta1), beta2(beta2), epsilon(epsilon) {
+        if (beta1 < 0 || beta1 >= 1 || beta2 < 0 || beta2 >= 1 || epsilon <= 0)
+            throw std::invalid_argument("Optimizer::Constructor() - Invalid argument(s)");
+    }
+
+    Type type() const { return rule; }
+
+    /** Number of moments, i.e arrays the size of the parameters, the rule keeps. */
+    int moments() const { return rule == SGD ? 0 : rule == Adam ? 2 : 1; }
+
+    /** Number of steps taken so far. */
+    long steps() const { return t; }
+
+    /** Sets the number of steps taken, e.g when resuming training with saved moments. */
+    void setSteps(long steps) {
+        t = steps;
+        correction = t > 0 ? std::sqrt(1 - std::pow(beta2, T(t))) / (1 - std::pow(beta1, T(t))) : 1;
+    }
+
+    /** Begins a step, call it once before the updates of all parameters of the step. */
+    void nextStep() { setSteps(t + 1); }
+
+    /**
+     * Takes the step of the rule for the n parameters p with gradients g, updating the
+     * parameters and their moments m and v in place. m and v may be null if the rule
+     * does not use them.
+     */
+    void update(T rate, T *p, const T *g, T *m, T *v, size_t n) const {
+        switch (rule) {
+            case SGD:      run<SGD>(rate, p, g, m, v, n);      break;
+            case Momentum: run<Momentum>(rate, p, g, m, v, n); break;
+            case Nesterov: run<Nesterov>(rate, p, g, m, v, n); break;
+            case Adam:     run<Adam>(rate, p, g, m, v, n);     break;
+        }
+    }
+};
+
+#endif /* OPTIMIZER_H */
@@ -0,0 +1,231 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Optional instrumentation of the hot paths, compiled in only if NN_PROFILE is defined
+ * (see "make profile"). Otherwise the macros below expand to nothing and cost nothing.
+ *
+ *      NN_PROFILE_SCOPE(name)     times the rest of the enclosing block
+ *      NN_PROFILE_FLOPS(n)        adds n floating point operations to the innermost scope
+ *      NN_PROFILE_ALLOC(bytes)    adds an allocation of the given size to the innermost scope
+ *
+ * Scopes nest, every thread keeps its own stack of them, so the time of a scope is split
+ * into its total time and its self time, the part not spent in scopes nested inside it.
+ * Counters only go to the innermost scope, e.g the FLOPs of a multiplication to "multiply"
+ * and not to "forward" around it. Statistics are kept per scope name, where the name is a
+ * string literal, and summed over all threads.
+ *
+ * Report prints the statistics since the last call to NextEpoch as a table sorted by self
+ * time, and every finished scope is also kept as an event for WriteTrace, which writes
+ * them in the Chrome trace event format, viewable in chrome://tracing or ui.perfetto.dev.
+ * At most max_events events are kept, later ones are only counted.
+ *
+ * Example:
+ *
+ *      void step() {
+ *          NN_PROFILE_SCOPE("step");
+ *          NN_PROFILE_FLOPS(2.0 * M * N * K);
+ *          ...
+ *      }
+ *      if (Profiler::Enabled) {
+ *          Profiler::Report(std::cout);
+ *          Profiler::NextEpoch();
+ *          Profiler::WriteTrace("trace.json");
+ *      }
+ */
+class Profiler {
+    using clock = std::chrono::steady_clock;
+    static const size_t max_events = 1 << 20;
+
+    struct Stats {
+        long calls = 0, allocations = 0;
+        double total_ns = 0, self_ns = 0, flops = 0, bytes = 0;
+    };
+    struct Event {
+        const char *name;
+        int thread, epoch;
+        long start_ns, duration_ns;
+    };
+    struct Frame {
+        const char *name;
+        long start_ns;
+        double child_ns = 0, flops = 0, bytes = 0;
+        long allocations = 0;
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::map<std::string, Stats> stats;
+        std::vector<Event> events;
+        long dropped = 0, epoch_start_ns = 0;
+        int epoch = 0;
+        const clock::time_point origin = clock::now();
+        std::atomic<int> num_threads{0};
+    };
+
+    static State& state() {
+        static State s;
+        return s;
+    }
+
+    static std::vector<Frame>& frames() {
+        thread_local std::vector<Frame> f;
+        return f;
+    }
+
+    static int threadIndex() {
+        thread_local int index = state().num_threads++;
+        return index;
+    }
+
+    static long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - state().origin).count();
+    }
+
+    static void escape(std::ostream &os, const std::string &s) {
+        for (char c : s)
+            os << (c == '"' || c == '\\' ? "\\" : "") << c;
+    }
+
+    Profiler() {/* To prevent instantiation */}
+
+public:
+#ifdef NN_PROFILE
+    static constexpr bool Enabled = true;
+#else
+    static constexpr bool Enabled = false;
+#endif
+
+    static void Begin(const char *name) {
+        Frame frame;
+        frame.name = name;
+        frame.start_ns = now();
+        frames().push_back(frame);
+    }
+
+    static void End() {
+        auto &stack = frames();
+        if (stack.empty())
+            throw std::logic_error("Profiler::End() - No scope to end");
+        Frame frame = stack.back();
+        stack.pop_back();
+        long duration = now() - frame.start_ns;
+        if (!stack.empty())
+            stack.back().child_ns += duration;
+
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        Stats &stats = s.stats[frame.name];
+        ++stats.calls;
+        stats.total_ns += duration;
+        stats.self_ns += duration - frame.child_ns;
+        stats.flops += frame.flops;
+        stats.bytes += frame.bytes;
+        stats.allocations += frame.allocations;
+        if (s.events.size() < max_events)
+            s.events.push_back({frame.name, threadIndex(), s.epoch, frame.start_ns, duration});
+        else
+            ++s.dropped;
+    }
+
+    static void AddFlops(double n) {
+        if (!frames().empty())
+            frames().back().flops += n;
+    }
+
+    static void AddAllocation(size_t bytes) {
+        if (frames().empty())
+            return;
+        frames().back().bytes += bytes;
+        ++frames().back().allocations;
+    }
+
+    /** Prints the statistics of every scope since the last call to NextEpoch. */
+    static void Report(std::ostream &os) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::vector<std::pair<std::string, Stats>> rows(s.stats.begin(), s.stats.end());
+        std::sort(rows.begin(), rows.end(), [](auto &a, auto &b){ return a.second.self_ns > b.second.self_ns; });
+        double wall_ns = std::max(1L, now() - s.epoch_start_ns);
+
+        char line[256];
+        std::string title = "Epoch " + std::to_string(s.epoch);
+        std::snprintf(line, sizeof(line), "> %-20s %10s %11s %11s %7s %10s %12s %8s\n", title.c_str(), "calls", "total ms", "self ms", "self %", "GFLOP/s", "alloc MB", "allocs");
+        os << line;
+        for (auto &row : rows) {
+            const Stats &st = row.second;
+            std::snprintf(line, sizeof(line), "> %-20s %10ld %11.2f %11.2f %6.1f%% %10.2f %12.3f %8ld\n",
+                          row.first.c_str(), st.calls, st.total_ns / 1e6, st.self_ns / 1e6, 100 * st.self_ns / wall_ns,
+                          st.self_ns > 0 ? st.flops / st.self_ns : 0., st.bytes / 1e6, st.allocations);
+            os << line;
+        }
+        std::snprintf(line, sizeof(line), "> %-20s %10s %11.2f\n", "wall time", "", wall_ns / 1e6);
+        os << line;
+    }
+
+    /** Clears the statistics of the table and numbers the following trace events as a new epoch. */
+    static void NextEpoch() {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.stats.clear();
+        s.epoch_start_ns = now();
+        ++s.epoch;
+    }
+
+    /** Writes all events kept so far as a Chrome trace event file. */
+    static void WriteTrace(const std::string &file_path) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::ofstream file(file_path);
+        if (!file.is_open())
+            throw std::runtime_error("Profiler::WriteTrace() - Unable to open " + file_path);
+        file << "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": " << s.dropped << "},\n"
+             << " \"traceEvents\": [\n";
+        file.precision(3);
+        file << std::fixed;
+        for (size_t i = 0; i < s.events.size(); ++i) {
+            const Event &e = s.events[i];
+            file << "  {\"name\": \"";
+            escape(file, e.name);
+            file << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread << ", \"ts\": " << e.start_ns / 1e3
+                 << ", \"dur\": " << e.duration_ns / 1e3 << ", \"args\": {\"epoch\": " << e.epoch << "}}"
+                 << (i + 1 < s.events.size() ? ",\n" : "\n");
+        }
+        file << "]}\n";
+    }
+};
+
+/** Begins a scope of the profiler when constructed and ends it when destroyed. */
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name) { Profiler::Begin(name); }
+    ~ProfileScope() { Profiler::End(); }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#ifdef NN_PROFILE
+#define NN_PROFILE_CONCAT_(a, b) a##b
+#define NN_PROFILE_CONCAT(a, b) NN_PROFILE_CONCAT_(a, b)
+#define NN_PROFILE_SCOPE(name) ProfileScope NN_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define NN_PROFILE_FLOPS(n) Profiler::AddFlops(n)
+#define NN_PROFILE_ALLOC(bytes) Profiler::AddAllocation(bytes)
+#else
+#define NN_PROFILE_SCOPE(name) ((void)0)
+#define NN_PROFILE_FLOPS(n) ((void)0)
+#define NN_PROFILE_ALLOC(bytes) ((void)0)
+#endif
+
+#endif /* PROFILER_H */
@@ -0,0 +1,237 @@
+#ifndef QUANTIZEDNETWORK_H
+#define QUANTIZEDNETWORK_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#if defined(__AVX512VNNI__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "Activation.h"
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+
+/**
+ * Inference-only copy of a trained NeuralNetwork with 8-bit weights and activations,
+ * made after training without any calibration data (post-training quantization).
+ *
+ *      Weights       int8, symmetric, one scale per output neuron (per channel):
+ *                    W[k][j] ~ scale[j] * Wq[k][j], with |Wq| <= 127
+ *      Activations   uint8, one scale and zero point per row computed on the fly:
+ *                    a[k] ~ row_scale * (q[k] - zero_point)
+ *
+ * so every output of a layer is a single int8 x uint8 dot product accumulated in int32,
+ *
+ *      z[j] = row_scale * scale[j] * (sum_k q[k] Wq[k][j] - zero_point * sum_k Wq[k][j]) + b[j]
+ *
+ * followed by the float activation function of the layer, after which the row is quantized
+ * again for the next layer. The first layer reads the raw uint8 pixels as they are,
+ * with a scale of 1/255 and no zero point, so images never go through floating point.
+ *
+ * The weights are packed like the B panels of Gemm.h: in blocks of NC outputs, and within a
+ * block four consecutive inputs of every output next to each other. The kernel then computes
+ * an R x NC tile of the output by broadcasting four uint8 inputs of a row against a whole
+ * register of weights, so the int32 sums of NC outputs build up side by side in registers
+ * and are never reduced horizontally. It uses VNNI (vpdpbusd, 64 uint8 x int8 products per
+ * instruction) if the compiler targets AVX-512 VNNI, otherwise AVX2 (both sides widened to
+ * int16 for vpmaddwd, since vpmaddubsw would saturate), otherwise scalar code.
+ * The output is in float whatever T is.
+ *
+ * Example:
+ *
+ *      QuantizedNetwork<double> Q(NN);                       // NN is a trained NeuralNetwork<double>
+ *      Matrix<float> probs = Q.evaluate(test.image(0), 100); // first 100 images of the test set
+ */
+template <typename T = double>
+class QuantizedNetwork {
+#if defined(__AVX512VNNI__)
+    static const size_t R = 6, NC = 32;  // tile of the kernel, 6 rows x 2 registers of 16 int32
+#elif defined(__AVX2__)
+    static const size_t R = 4, NC = 8;   // 4 rows x 8 int32, as two registers of pairwise sums
+#else
+    static const size_t R = 4, NC = 4;
+#endif
+
+    struct Layer {
+        size_t in, groups, out, padded_out; // groups of four inputs, outputs padded to NC
+        std::vector<int8_t> W;              // packed, see pack()
+        std::vector<int32_t> W_sums;        // sum of the weights of every output, to subtract the zero point of the input
+        std::vector<float> scale, bias;
+        Activation::Type activation;
+    };
+
+    std::vector<Layer> layers;
+
+    static size_t pad(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+
+    /** Index of weight (k, j) in the packed layout: [block of NC outputs][k / 4][j % NC][k % 4]. */
+    static size_t pack(const Layer &layer, size_t k, size_t j) {
+        return ((j / NC * layer.groups + k / 4) * NC + j % NC) * 4 + k % 4;
+    }
+
+    static int32_t load4(const uint8_t *p) {
+        int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        return x;
+    }
+
+    /**
+     * out[r * NC + c] = sum_k q[r * q_stride + k] * W(k, c) for r < R and c < NC, where w
+     * is one packed block of NC outputs over groups * 4 inputs.
+     */
+    static void kernel(const uint8_t *q, size_t q_stride, const int8_t *w, size_t groups, int32_t *out) {
+#if defined(__AVX512VNNI__)
+        __m512i acc[R][2];
+        for (size_t r = 0; r < R; ++r)
+            acc[r][0] = acc[r][1] = _mm512_setzero_si512();
+        for (size_t g = 0; g < groups; ++g, w += 4 * NC) {
+            __m512i w0 = _mm512_loadu_si512(w), w1 = _mm512_loadu_si512(w + 64);
+            for (size_t r = 0; r < R; ++r) {
+                __m512i x = _mm512_set1_epi32(load4(q + r * q_stride + 4 * g));
+                acc[r][0] = _mm512_dpbusd_epi32(acc[r][0], x, w0);
+                acc[r][1] = _mm512_dpbusd_epi32(acc[r][1], x, w1);
+            }
+        }
+        for (size_t r = 0; r < R; ++r) {
+            _mm512_storeu_si512(out + r * NC, acc[r][0]);
+            _mm512_storeu_si512(out + r * NC + 16, acc[r][1]);
+        }
+#elif defined(__AVX2__)
+        // lanes hold the sums of inputs (0,1) and (2,3) of outputs 0-3 and 4-7 respectively
+        __m256i acc[R][2];
+        for (size_t r = 0; r < R; ++r)
+            acc[r][0] = acc[r][1] = _mm256_setzero_si256();
+        for (size_t g = 0; g < groups; ++g, w += 4 * NC) {
+            __m256i wv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));
+            __m256i w0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(wv)), w1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(wv, 1));
+            for (size_t r = 0; r < R; ++r) {
+                __m256i x = _mm256_cvtepu8_epi16(_mm_set1_epi32(load4(q + r * q_stride + 4 * g)));
+                acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(x, w0));
+                acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(x, w1));
+            }
+        }
+        for (size_t r = 0; r < R; ++r) {
+            // pairwise sums come out as outputs 0 1 4 5 | 2 3 6 7, the permute restores the order
+            __m256i sums = _mm256_permute4x64_epi64(_mm256_hadd_epi32(acc[r][0], acc[r][1]), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * NC), sums);
+        }
+#else
+        std::fill(out, out + R * NC, 0);
+        for (size_t g = 0; g < groups; ++g, w += 4 * NC)
+            for (size_t r = 0; r < R; ++r)
+                for (size_t c = 0; c < NC; ++c)
+                    for (size_t t = 0; t < 4; ++t)
+                        out[r * NC + c] += int32_t(q[r * q_stride + 4 * g + t]) * w[c * 4 + t];
+#endif
+    }
+
+    /** Quantizes the n values of a into q, asymmetric over [min(a, 0), max(a, 0)]. */
+    static void quantizeRow(const float *a, size_t n, uint8_t *q, float &row_scale, int32_t &zero_point) {
+        float lo = std::min(0.f, *std::min_element(a, a + n)), hi = std::max(0.f, *std::max_element(a, a + n));
+        row_scale = hi > lo ? (hi - lo) / 255 : 1;
+        zero_point = std::lround(-lo / row_scale);
+        float inv = 1 / row_scale, offset = zero_point + 0.5f; // rounds by truncating, the values are positive
+        for (size_t k = 0; k < n; ++k)
+            q[k] = std::min(255.f, std::max(0.f, a[k] * inv + offset));
+    }
+
+public:
+    /** Intermediate buffers of evaluate, reused between calls like NeuralNetwork::Workspace. */
+    struct Workspace {
+        std::vector<uint8_t> q;          // quantized input of the current layer, one row per image
+        std::vector<float> row_scale;
+        std::vector<int32_t> zero_point;
+        Matrix<float> a;                 // float output of the current layer
+    };
+
+    explicit QuantizedNetwork(const NeuralNetwork<T> &NN) {
+        for (int l = 0; l < NN.numLayers(); ++l) {
+            const Matrix<T> &W = NN.weights(l), &b = NN.biases(l);
+            Layer layer;
+            layer.in = W.rows();
+            layer.out = W.cols();
+            layer.groups = pad(layer.in, 4) / 4;
+            layer.padded_out = pad(layer.out, NC);
+            layer.W.resize(layer.padded_out * layer.groups * 4); // value-initialized, so the padding is zero
+            layer.W_sums.assign(layer.padded_out, 0);
+            layer.scale.assign(layer.padded_out, 0);
+            layer.bias.assign(b.begin(), b.end());
+            layer.activation = NN.activation(l);
+
+            for (size_t j = 0; j < layer.out; ++j) {
+                double max = 0;
+                for (size_t k = 0; k < layer.in; ++k)
+                    max = std::max(max, std::abs(double(W(k, j))));
+                layer.scale[j] = max > 0 ? max / 127 : 1;
+                for (size_t k = 0; k < layer.in; ++k) {
+                    int8_t w = std::lround(W(k, j) / layer.scale[j]);
+                    layer.W[pack(layer, k, j)] = w;
+                    layer.W_sums[j] += w;
+                }
+            }
+            layers.push_back(std::move(layer));
+        }
+    }
+
+    int inputs() const { return layers.front().in; }
+    int outputs() const { return layers.back().out; }
+
+    /** Evaluates rows images of raw pixels, stored one after the other with inputs() bytes each. */
+    Matrix<float> evaluate(const unsigned char *pixels, int rows) const {
+        Workspace ws;
+        evaluate(pixels, rows, ws);
+        return std::move(ws.a);
+    }
+
+    /**
+     * Same as above but works in the given workspace and returns a reference to
+     * the result in it, valid until the workspace is used again.
+     */
+    const Matrix<float>& evaluate(const unsigned char *pixels, int rows, Workspace &ws) const {
+        if (rows < 1)
+            throw std::invalid_argument("QuantizedNetwork::evaluate() - Need at least one row");
+
+        // rows are padded to a multiple of the tile with zeros, inputs to a multiple of four
+        const Layer &first = layers.front();
+        const size_t padded_rows = pad(rows, R);
+        size_t stride = first.groups * 4;
+        ws.q.assign(padded_rows * stride, 0);
+        ws.row_scale.assign(padded_rows, 1.f / 255);
+        ws.zero_point.assign(padded_rows, 0);
+        for (int i = 0; i < rows; ++i)
+            std::memcpy(&ws.q[i * stride], pixels + i * first.in, first.in);
+
+        for (size_t l = 0; l < layers.size(); ++l) {
+            const Layer &layer = layers[l];
+            ws.a.resize(rows, layer.out);
+            int32_t acc[R * NC];
+            for (size_t i = 0; i < size_t(rows); i += R) {
+                for (size_t j = 0; j < layer.out; j += NC) {
+                    kernel(&ws.q[i * stride], stride, &layer.W[j * layer.groups * 4], layer.groups, acc);
+                    for (size_t r = 0; r < R && i + r < size_t(rows); ++r) {
+                        float *a = ws.a.begin(i + r), row_scale = ws.row_scale[i + r];
+                        int32_t zero_point = ws.zero_point[i + r];
+                        for (size_t c = 0; c < NC && j + c < layer.out; ++c)
+                            a[j + c] = row_scale * layer.scale[j + c] * (acc[r * NC + c] - zero_point * layer.W_sums[j + c]);
+                    }
+                }
+                for (size_t r = i; r < i + R && r < size_t(rows); ++r)
+                    Activation::Apply(layer.activation, layer.bias.data(), ws.a.begin(r), layer.out);
+            }
+            if (l + 1 == layers.size())
+                break;
+
+            // quantize the output, zero padded, as the input of the next layer
+            stride = layers[l + 1].groups * 4;
+            ws.q.assign(padded_rows * stride, 0);
+            for (int i = 0; i < rows; ++i)
+                quantizeRow(ws.a.begin(i), layer.out, &ws.q[i * stride], ws.row_scale[i], ws.zero_point[i]);
+        }
+        return ws.a;
+    }
+};
+
+#endif /* QUANTIZEDNETWORK_H */
@@ -0,0 +1,326 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "ThreadPool.h"
+
+/**
+ * Counter-based random numbers, Philox4x32-10 (Salmon et al. 2011, "Parallel random
+ * numbers: as easy as 1, 2, 3"). Block n of a stream is the counter (n, stream) mixed
+ * under a key, the seed, by ten rounds of multiplies and xors, so every value of every
+ * stream is computed straight from its index, with no state carried from one to the next.
+ *
+ * So filling an array is a pure function of the seed, the stream and the index of each
+ * value: split over a ThreadPool of any size, in any order, a fill gives bit-identical
+ * results (see uniform, normal and the initializations of weights below). The streams of
+ * a seed do not overlap, and instead of sharing the state of one generator like rand()
+ * or a std::mt19937, every user takes its own: the weights of every layer, the shuffle of
+ * every epoch, the distortion of every image (see Use).
+ *
+ * Blocks are generated a batch of lanes at a time, the rounds on whole AVX-512 or AVX2
+ * registers if the target has them, like Simd.h, and on scalars otherwise, see
+ * "make bench SECTION=random".
+ *
+ * For sequential use, e.g shuffle, the generator also walks its stream from the start.
+ * shuffle is a Fisher-Yates shuffle with its own unbiased bounded integers, so unlike
+ * std::shuffle it gives the same order with every standard library.
+ *
+ * Example:
+ *
+ *      Random(seed, Random::Weights + l).he(W, &pool);     // layer l, the same values with any pool
+ *      Random(seed, Random::Shuffle + epoch).shuffle(order.begin(), order.end());
+ *      Random(seed).normal(p, n, 0.0, 1.0);
+ */
+class Random {
+public:
+    /** Streams of the users of a seed, apart in the top byte so that they never overlap. */
+    enum Use : uint64_t { Other = 0, Weights = 1ull << 56, Shuffle = 2ull << 56, Augment = 3ull << 56 };
+
+    static constexpr uint64_t DefaultSeed = 0x853C49E6748FEA9Bull;
+
+    using result_type = uint32_t;
+
+private:
+    static constexpr size_t lanes = 64;              // blocks generated at once
+    static constexpr size_t fill_chunk = 1 << 16;    // values generated per job of a pool
+    static constexpr uint64_t M0 = 0xD2511F53, M1 = 0xCD9E8D57; // multipliers of the rounds
+    static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85; // increments of the key
+
+    uint32_t key[2];
+    uint64_t m_stream;
+
+    // sequential use, the words of the blocks [next - lanes, next)
+    uint64_t next = 0;
+    uint32_t words[4][lanes];
+    size_t used = 4 * lanes;
+
+    /** Floating point type the values of T are generated in, float for float and smaller. */
+    template <typename T>
+    using real_t = typename std::conditional<sizeof(T) <= 4, float, double>::type;
+
+    /** Values of T per block, one per word for float, one per two words for double. */
+    template <typename T>
+    static constexpr size_t per_block = sizeof(real_t<T>) == 4 ? 4 : 2;
+
+#if defined(__AVX512F__)
+    /** Products of the 32 bit lanes of a and m, the high halves returned and the low ones in lo. */
+    static __m512i MulHiLo(__m512i a, __m512i m, __m512i &lo) {
+        // masked forms on a zeroed source, for the same reason as in Simd.h
+        const __m512i zero = _mm512_setzero_si512();
+        const __mmask8 all = 0xFF;
+        __m512i even = _mm512_mask_mul_epu32(zero, all, a, m);
+        __m512i odd = _mm512_mask_mul_epu32(zero, all, _mm512_mask_srli_epi64(zero, all, a, 32), m);
+        lo = _mm512_mask_blend_epi32(0xAAAA, even, _mm512_mask_slli_epi64(zero, all, odd, 32));
+        return _mm512_mask_blend_epi32(0xAAAA, _mm512_mask_srli_epi64(zero, all, even, 32), odd);
+    }
+#elif defined(__AVX2__)
+    static __m256i MulHiLo(__m256i a, __m256i m, __m256i &lo) {
+        __m256i even = _mm256_mul_epu32(a, m), odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+        lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+        return _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    }
+#endif
+
+    /**
+     * The ten rounds of Philox on lanes counters in place, word w of counter i in c[w][i].
+     * A register holds the same word of several counters, and the 32 x 32 -> 64 bit
+     * multiplies of the even and the odd lanes are blended back into words of 32 bits.
+     */
+    static void Rounds(uint32_t c[4][lanes], uint32_t k0, uint32_t k1) {
+#if defined(__AVX512F__)
+        // independent registers in flight to hide the latency of the multiplies
+        constexpr size_t width = 16, regs = lanes / width;
+        __m512i c0[regs], c1[regs], c2[regs], c3[regs];
+        for (size_t r = 0; r < regs; ++r) {
+            c0[r] = _mm512_loadu_si512(c[0] + r * width);
+            c1[r] = _mm512_loadu_si512(c[1] + r * width);
+            c2[r] = _mm512_loadu_si512(c[2] + r * width);
+            c3[r] = _mm512_loadu_si512(c[3] + r * width);
+        }
+        const __m512i m0 = _mm512_set1_epi64(M0), m1 = _mm512_set1_epi64(M1);
+        for (int round = 0; round < 10; ++round, k0 += W0, k1 += W1)
+            for (size_t r = 0; r < regs; ++r) {
+                __m512i lo0, lo1, hi0 = MulHiLo(c0[r], m0, lo0), hi1 = MulHiLo(c2[r], m1, lo1);
+                c0[r] = _mm512_xor_si512(_mm512_xor_si512(hi1, c1[r]), _mm512_set1_epi32(k0));
+                c2[r] = _mm512_xor_si512(_mm512_xor_si512(hi0, c3[r]), _mm512_set1_epi32(k1));
+                c1[r] = lo1;
+                c3[r] = lo0;
+            }
+        for (size_t r = 0; r < regs; ++r) {
+            _mm512_storeu_si512(c[0] + r * width, c0[r]);
+            _mm512_storeu_si512(c[1] + r * width, c1[r]);
+            _mm512_storeu_si512(c[2] + r * width, c2[r]);
+            _mm512_storeu_si512(c[3] + r * width, c3[r]);
+        }
+#elif defined(__AVX2__)
+        constexpr size_t width = 8, regs = lanes / width;
+        __m256i c0[regs], c1[regs], c2[regs], c3[regs];
+        auto load = [](const uint32_t *p){ return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); };
+        auto store = [](uint32_t *p, __m256i v){ _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); };
+        for (size_t r = 0; r < regs; ++r) {
+            c0[r] = load(c[0] + r * width);
+            c1[r] = load(c[1] + r * width);
+            c2[r] = load(c[2] + r * width);
+            c3[r] = load(c[3] + r * width);
+        }
+        const __m256i m0 = _mm256_set1_epi64x(M0), m1 = _mm256_set1_epi64x(M1);
+        for (int round = 0; round < 10; ++round, k0 += W0, k1 += W1)
+            for (size_t r = 0; r < regs; ++r) {
+                __m256i lo0, lo1, hi0 = MulHiLo(c0[r], m0, lo0), hi1 = MulHiLo(c2[r], m1, lo1);
+                c0[r] = _mm256_xor_si256(_mm256_xor_si256(hi1, c1[r]), _mm256_set1_epi32(k0));
+                c2[r] = _mm256_xor_si256(_mm256_xor_si256(hi0, c3[r]), _mm256_set1_epi32(k1));
+                c1[r] = lo1;
+                c3[r] = lo0;
+            }
+        for (size_t r = 0; r < regs; ++r) {
+            store(c[0] + r * width, c0[r]);
+            store(c[1] + r * width, c1[r]);
+            store(c[2] + r * width, c2[r]);
+            store(c[3] + r * width, c3[r]);
+        }
+#else
+        for (int round = 0; round < 10; ++round, k0 += W0, k1 += W1)
+            for (size_t i = 0; i < lanes; ++i) {
+                uint64_t p0 = M0 * c[0][i], p1 = M1 * c[2][i];
+                uint32_t n0 = uint32_t(p1 >> 32) ^ c[1][i] ^ k0, n2 = uint32_t(p0 >> 32) ^ c[3][i] ^ k1;
+                c[1][i] = uint32_t(p1);
+                c[3][i] = uint32_t(p0);
+                c[0][i] = n0;
+                c[2][i] = n2;
+            }
+#endif
+    }
+
+    /** Blocks [first, first + lanes) of the stream, word w of block i in out[w][i]. */
+    void blocks(uint64_t first, uint32_t out[4][lanes]) const {
+        for (size_t i = 0; i < lanes; ++i) {
+            out[0][i] = uint32_t(first + i);
+            out[1][i] = uint32_t((first + i) >> 32);
+            out[2][i] = uint32_t(m_stream);
+            out[3][i] = uint32_t(m_stream >> 32);
+        }
+        Rounds(out, key[0], key[1]);
+    }
+
+    /**
+     * Writes the values [offset, offset + n) of the stream into out. The values are
+     * generated a batch of lanes blocks at a time as uniforms in [0,1), value j of a batch
+     * from word j / lanes of block j % lanes, and transform(u, size) then maps the whole
+     * batch in place, so a value never depends on where a fill starts or ends.
+     */
+    template <typename T, typename Transform>
+    void generate(T *out, size_t n, uint64_t offset, Transform transform) const {
+        using R = real_t<T>;
+        constexpr size_t per = per_block<T>, batch = lanes * per;
+        alignas(64) R u[batch];
+        uint32_t w[4][lanes];
+        for (uint64_t first = offset / batch * batch; first < offset + n; first += batch) {
+            blocks(first / per, w);
+            if (per == 4) {
+                for (size_t v = 0; v < 4; ++v)
+                    for (size_t i = 0; i < lanes; ++i)
+                        u[v * lanes + i] = R(w[v][i] >> 8) * R(1.0 / (1 << 24));
+            } else {
+                // the top 52 bits of two words as the mantissa of a double in [1,2), minus one
+                for (size_t v = 0; v < 2; ++v)
+                    for (size_t i = 0; i < lanes; ++i) {
+                        uint64_t bits = 0x3FF0000000000000ull | (uint64_t(w[2 * v + 1][i]) << 20 | w[2 * v][i] >> 12);
+                        R one_to_two;
+                        std::memcpy(&one_to_two, &bits, sizeof(bits));
+                        u[v * lanes + i] = one_to_two - 1;
+                    }
+            }
+            transform(u, batch);
+            uint64_t from = std::max(first, offset), to = std::min(first + batch, offset + n);
+            std::copy(u + (from - first), u + (to - first), out + (from - offset));
+        }
+    }
+
+    /** Runs fill(out, count, offset) over the n values, in parallel chunks if given a pool. */
+    template <typename T, typename Fill>
+    static void chunked(T *out, size_t n, ThreadPool *pool, Fill fill) {
+        if (!pool || pool->size() == 1 || n <= fill_chunk) {
+            fill(out, n, 0);
+            return;
+        }
+        pool->parallelFor((n + fill_chunk - 1) / fill_chunk, [&](int chunk){
+            size_t begin = chunk * fill_chunk;
+            fill(out + begin, std::min(fill_chunk, n - begin), begin);
+        });
+    }
+
+public:
+    explicit Random(uint64_t seed = DefaultSeed, uint64_t stream = 0) :
+    key{uint32_t(seed), uint32_t(seed >> 32)}, m_stream(stream) { }
+
+    uint64_t seed() const { return uint64_t(key[1]) << 32 | key[0]; }
+    uint64_t stream() const { return m_stream; }
+
+    /** Uniform in [lo, hi), the values [offset, offset + n) of the stream. */
+    template <typename T>
+    void uniform(T *out, size_t n, T lo, T hi, uint64_t offset = 0) const {
+        using R = real_t<T>;
+        const R scale = R(hi) - R(lo), shift = R(lo);
+        generate(out, n, offset, [=](R *u, size_t size){
+            for (size_t i = 0; i < size; ++i)
+                u[i] = u[i] * scale + shift;
+        });
+    }
+
+    /** Normal with the given mean and standard deviation, by the Box-Muller transform of pairs of uniforms. */
+    template <typename T>
+    void normal(T *out, size_t n, T mean, T stddev, uint64_t offset = 0) const {
+        using R = real_t<T>;
+        const R m = R(mean), s = R(stddev), two_pi = R(6.283185307179586);
+        generate(out, n, offset, [=](R *u, size_t size){
+            // value i and i + size / 2 of a batch are a pair, 1 - u is in (0,1] so the log is finite
+            for (size_t i = 0; i < size / 2; ++i) {
+                R r = s * std::sqrt(-2 * std::log(1 - u[i])), angle = two_pi * u[i + size / 2];
+                u[i] = m + r * std::cos(angle);
+                u[i + size / 2] = m + r * std::sin(angle);
+            }
+        });
+    }
+
+    /** Same as above for all values of a Matrix, in parallel chunks if given a pool. */
+    template <typename M>
+    void uniform(M &m, typename M::value_type lo, typename M::value_type hi, ThreadPool *pool = nullptr) const {
+        chunked(m.begin(), m.rows() * m.cols(), pool, [&](typename M::value_type *out, size_t n, size_t offset){
+            uniform(out, n, lo, hi, offset);
+        });
+    }
+
+    template <typename M>
+    void normal(M &m, typename M::value_type mean, typename M::value_type stddev, ThreadPool *pool = nullptr) const {
+        chunked(m.begin(), m.rows() * m.cols(), pool, [&](typename M::value_type *out, size_t n, size_t offset){
+            normal(out, n, mean, stddev, offset);
+        });
+    }
+
+    /**
+     * Glorot (Xavier) initialization of the in x out weights W, uniform in [-r, r) with
+     * r = sqrt(6 / (in + out)), which keeps the variance of the activations and of the
+     * gradients through layers with sigmoid or tanh.
+     */
+    template <typename M>
+    void xavier(M &W, ThreadPool *pool = nullptr) const {
+        using T = typename M::value_type;
+        T r = std::sqrt(T(6) / (W.rows() + W.cols()));
+        uniform(W, -r, r, pool);
+    }
+
+    /** He initialization, uniform in [-r, r) with r = sqrt(6 / in), for layers with ReLU. */
+    template <typename M>
+    void he(M &W, ThreadPool *pool = nullptr) const {
+        using T = typename M::value_type;
+        T r = std::sqrt(T(6) / W.rows());
+        uniform(W, -r, r, pool);
+    }
+
+    // sequential use, a UniformRandomBitGenerator walking the words of the stream from the start
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()() {
+        if (used == 4 * lanes) {
+            blocks(next, words);
+            next += lanes;
+            used = 0;
+        }
+        // the four words of a block in a row, then the next block
+        uint32_t word = words[used % 4][used / 4];
+        ++used;
+        return word;
+    }
+
+    /** Uniform integer in [0, n), without the bias of a modulo (Lemire 2019). */
+    uint32_t below(uint32_t n) {
+        uint64_t m = uint64_t((*this)()) * n;
+        if (uint32_t(m) < n) {
+            const uint32_t threshold = -n % n;
+            while (uint32_t(m) < threshold)
+                m = uint64_t((*this)()) * n;
+        }
+        return m >> 32;
+    }
+
+    /** Fisher-Yates shuffle of [first, last), the same order for a stream on every platform. */
+    template <typename It>
+    void shuffle(It first, It last) {
+        for (auto n = std::distance(first, last); n > 1; --n)
+            std::iter_swap(first + (n - 1), first + below(n));
+    }
+};
+
+#endif /* RANDOM_H */
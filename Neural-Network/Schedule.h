@@ -0,0 +1,88 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Learning rate of every epoch of a training run, from the rate it starts at:
+ *
+ *      Constant      rate
+ *      Step          rate * factor^(epoch / every), e.g halved every 5 epochs
+ *      Exponential   rate * factor^epoch
+ *      Cosine        rate * (1 + cos(pi * epoch / epochs)) / 2, from rate down towards zero,
+ *                    and kept at the rate of the last epoch after the run, so it never reaches zero
+ *
+ * Epochs count from zero, so epoch 0 always trains at the starting rate. A rate only
+ * depends on its epoch, so a run resumed from a checkpoint continues on the same schedule.
+ * Parse reads the schedules as written on the command line (see main.cpp).
+ *
+ * Example:
+ *
+ *      LearnRateSchedule schedule = LearnRateSchedule::Parse("step:0.5:5", 0.1, 20);
+ *      NN.setLearnRate(schedule.rate(epoch));
+ */
+class LearnRateSchedule {
+public:
+    enum Type { Constant, Step, Exponential, Cosine };
+
+private:
+    Type type;
+    double start, factor;
+    int every, epochs;
+
+    static constexpr double pi = 3.141592653589793;
+
+public:
+    /**
+     * @param rate Rate of the first epoch
+     * @param factor Rate is multiplied by per decay, Step and Exponential only
+     * @param every Epochs between decays, Step only
+     * @param epochs Length of the run, Cosine only
+     */
+    explicit LearnRateSchedule(double rate, Type type = Constant, double factor = 0.5, int every = 1, int epochs = 1) :
+    type(type), start(rate), factor(factor), every(every), epochs(epochs) {
+        if (rate <= 0 || factor <= 0 || every < 1 || epochs < 1)
+            throw std::invalid_argument("LearnRateSchedule::Constructor() - Invalid argument(s)");
+    }
+
+    double rate(int epoch) const {
+        if (epoch < 0)
+            throw std::out_of_range("LearnRateSchedule::rate() - Negative epoch");
+        switch (type) {
+            case Step:        return start * std::pow(factor, epoch / every);
+            case Exponential: return start * std::pow(factor, epoch);
+            case Cosine:      return start * (1 + std::cos(pi * std::min(epoch, epochs - 1) / epochs)) / 2;
+            default:          return start;
+        }
+    }
+
+    Type schedule() const { return type; }
+
+    /**
+     * Schedule written as "constant", "step:factor:every", "exp:factor" or "cosine",
+     * starting at rate, over a run of the given number of epochs.
+     */
+    static LearnRateSchedule Parse(const std::string &spec, double rate, int epochs) {
+        std::string name = spec.substr(0, spec.find(':'));
+        std::string args = name.size() < spec.size() ? spec.substr(name.size() + 1) : "";
+        try {
+            if (name == "constant" && args.empty())
+                return LearnRateSchedule(rate);
+            if (name == "cosine" && args.empty())
+                return LearnRateSchedule(rate, Cosine, 1, 1, epochs);
+            if (name == "exp" && !args.empty() && args.find(':') == std::string::npos)
+                return LearnRateSchedule(rate, Exponential, std::stod(args));
+            size_t colon = args.find(':');
+            if (name == "step" && colon != std::string::npos)
+                return LearnRateSchedule(rate, Step, std::stod(args.substr(0, colon)), std::stoi(args.substr(colon + 1)));
+        } catch (const std::logic_error&) {
+            // std::stod and std::stoi throw invalid_argument and out_of_range, both logic errors
+        }
+        throw std::invalid_argument("LearnRateSchedule::Parse() - Invalid schedule: " + spec);
+    }
+};
+
+#endif /* SCHEDULE_H */
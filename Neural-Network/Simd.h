@@ -0,0 +1,175 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Thin wrapper around the SIMD registers of the target, specialized on the
+ * scalar type at compile time. The generic template is a scalar fallback with
+ * a width of one, so any kernel written against Simd<T> works for every T.
+ *
+ * The widest instruction set enabled by the compiler flags is used,
+ * i.e AVX-512 if available, otherwise AVX2+FMA, otherwise scalar code.
+ *
+ * Example:
+ *
+ *      using S = Simd<double>;
+ *      S::reg a = S::load(p), b = S::set1(2.0);
+ *      S::store(p, S::fmadd(a, b, S::zero())); // p[0..S::width) *= 2
+ *
+ * round() rounds to the nearest integer and scale2(x, n) returns x * 2^n for an
+ * integral valued n, the building blocks of the exponential in FastMath.h.
+ * loadBytes() loads width unsigned bytes converted to T, e.g the pixels of an IDX file.
+ *
+ * The AVX-512 operations GCC implements on an unset source register, which it then warns
+ * about as uninitialized, are written as their masked forms on a zeroed source with every
+ * lane set, which compile to the same instructions.
+ */
+template <typename T>
+struct Simd {
+    using reg = T;
+    static constexpr int width = 1;
+
+    static reg load(const T *p)          { return *p; }
+    static reg loadBytes(const unsigned char *p) { return T(*p); }
+    static void store(T *p, reg r)       { *p = r; }
+    static reg set1(T t)                 { return t; }
+    static reg zero()                    { return T(); }
+    static reg add(reg a, reg b)         { return a + b; }
+    static reg sub(reg a, reg b)         { return a - b; }
+    static reg mul(reg a, reg b)         { return a * b; }
+    static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+    static reg div(reg a, reg b)         { return a / b; }
+    static reg sqrt(reg a)               { return std::sqrt(a); }
+    static reg max(reg a, reg b)         { return std::max(a, b); }
+    static reg min(reg a, reg b)         { return std::min(a, b); }
+    static reg round(reg a)              { return std::nearbyint(a); }
+    static reg scale2(reg a, reg n)      { return std::ldexp(a, int(n)); }
+};
+
+#if defined(__AVX512F__)
+
+template <>
+struct Simd<double> {
+    using reg = __m512d;
+    static constexpr int width = 8;
+    static constexpr __mmask8 all = 0xFF;
+
+    static reg load(const double *p)      { return _mm512_loadu_pd(p); }
+    static reg loadBytes(const unsigned char *p) {
+        return _mm512_mask_cvtepi32_pd(zero(), all, _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    static void store(double *p, reg r)   { _mm512_storeu_pd(p, r); }
+    static reg set1(double t)             { return _mm512_set1_pd(t); }
+    static reg zero()                     { return _mm512_setzero_pd(); }
+    static reg add(reg a, reg b)          { return _mm512_add_pd(a, b); }
+    static reg sub(reg a, reg b)          { return _mm512_sub_pd(a, b); }
+    static reg mul(reg a, reg b)          { return _mm512_mul_pd(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+    static reg div(reg a, reg b)          { return _mm512_div_pd(a, b); }
+    static reg sqrt(reg a)                { return _mm512_mask_sqrt_pd(zero(), all, a); }
+    static reg max(reg a, reg b)          { return _mm512_mask_max_pd(zero(), all, a, b); }
+    static reg min(reg a, reg b)          { return _mm512_mask_min_pd(zero(), all, a, b); }
+    static reg round(reg a) {
+        return _mm512_mask_roundscale_pd(zero(), all, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static reg scale2(reg a, reg n)       { return _mm512_mask_scalef_pd(zero(), all, a, n); }
+};
+
+template <>
+struct Simd<float> {
+    using reg = __m512;
+    static constexpr int width = 16;
+    static constexpr __mmask16 all = 0xFFFF;
+
+    static reg load(const float *p)       { return _mm512_loadu_ps(p); }
+    static reg loadBytes(const unsigned char *p) {
+        __m512i bytes = _mm512_mask_cvtepu8_epi32(_mm512_setzero_si512(), all, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        return _mm512_mask_cvtepi32_ps(zero(), all, bytes);
+    }
+    static void store(float *p, reg r)    { _mm512_storeu_ps(p, r); }
+    static reg set1(float t)              { return _mm512_set1_ps(t); }
+    static reg zero()                     { return _mm512_setzero_ps(); }
+    static reg add(reg a, reg b)          { return _mm512_add_ps(a, b); }
+    static reg sub(reg a, reg b)          { return _mm512_sub_ps(a, b); }
+    static reg mul(reg a, reg b)          { return _mm512_mul_ps(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    static reg div(reg a, reg b)          { return _mm512_div_ps(a, b); }
+    static reg sqrt(reg a)                { return _mm512_mask_sqrt_ps(zero(), all, a); }
+    static reg max(reg a, reg b)          { return _mm512_mask_max_ps(zero(), all, a, b); }
+    static reg min(reg a, reg b)          { return _mm512_mask_min_ps(zero(), all, a, b); }
+    static reg round(reg a) {
+        return _mm512_mask_roundscale_ps(zero(), all, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    }
+    static reg scale2(reg a, reg n)       { return _mm512_mask_scalef_ps(zero(), all, a, n); }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+template <>
+struct Simd<double> {
+    using reg = __m256d;
+    static constexpr int width = 4;
+
+    static reg load(const double *p)      { return _mm256_loadu_pd(p); }
+    static reg loadBytes(const unsigned char *p) {
+        int bytes;
+        std::memcpy(&bytes, p, sizeof(bytes));
+        return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+    }
+    static void store(double *p, reg r)   { _mm256_storeu_pd(p, r); }
+    static reg set1(double t)             { return _mm256_set1_pd(t); }
+    static reg zero()                     { return _mm256_setzero_pd(); }
+    static reg add(reg a, reg b)          { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b)          { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b)          { return _mm256_mul_pd(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+    static reg div(reg a, reg b)          { return _mm256_div_pd(a, b); }
+    static reg sqrt(reg a)                { return _mm256_sqrt_pd(a); }
+    static reg max(reg a, reg b)          { return _mm256_max_pd(a, b); }
+    static reg min(reg a, reg b)          { return _mm256_min_pd(a, b); }
+    static reg round(reg a)               { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static reg scale2(reg a, reg n) {
+        // builds 2^n in the exponent field, n has to be in the normal range
+        __m256i e = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+        e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+        return _mm256_mul_pd(a, _mm256_castsi256_pd(e));
+    }
+};
+
+template <>
+struct Simd<float> {
+    using reg = __m256;
+    static constexpr int width = 8;
+
+    static reg load(const float *p)       { return _mm256_loadu_ps(p); }
+    static reg loadBytes(const unsigned char *p) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+    }
+    static void store(float *p, reg r)    { _mm256_storeu_ps(p, r); }
+    static reg set1(float t)              { return _mm256_set1_ps(t); }
+    static reg zero()                     { return _mm256_setzero_ps(); }
+    static reg add(reg a, reg b)          { return _mm256_add_ps(a, b); }
+    static reg sub(reg a, reg b)          { return _mm256_sub_ps(a, b); }
+    static reg mul(reg a, reg b)          { return _mm256_mul_ps(a, b); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    static reg div(reg a, reg b)          { return _mm256_div_ps(a, b); }
+    static reg sqrt(reg a)                { return _mm256_sqrt_ps(a); }
+    static reg max(reg a, reg b)          { return _mm256_max_ps(a, b); }
+    static reg min(reg a, reg b)          { return _mm256_min_ps(a, b); }
+    static reg round(reg a)               { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static reg scale2(reg a, reg n) {
+        // builds 2^n in the exponent field, n has to be in the normal range
+        __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(a, _mm256_castsi256_ps(e));
+    }
+};
+
+#endif
+
+#endif /* SIMD_H */
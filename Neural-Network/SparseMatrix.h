@@ -0,0 +1,190 @@
+#ifndef SPARSEMATRIX_H
+#define SPARSEMATRIX_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "Gemm.h"
+#include "Matrix.h"
+#include "Profiler.h"
+#include "Simd.h"
+
+/**
+ * Matrix that only stores its non-zero values, in compressed sparse row (CSR) format:
+ * the values of row i are values[row_start[i], row_start[i+1]), in the columns given
+ * by col_index. The transpose is kept as well, in the same format, so that both A * B
+ * and A^T * B are computed a row of the result at a time.
+ *
+ * Meant for batches of input data that are mostly zeros, like MNIST where about four
+ * out of five pixels are blank. multiply below then only touches the rows of the
+ * weights of the non-zero inputs, i.e does a fifth of the work of the dense product
+ * for the first layer, forward and for the gradient of its weights (see NeuralNetwork::train).
+ * Both formats are built once per batch, by assign, e.g on the producer thread of a
+ * BatchLoader, and only reallocate when a batch is larger than any before.
+ *
+ * Example:
+ *
+ *      SparseMatrix<double> sparse(data); // data is a dense batch
+ *      sparse.density();                  // e.g 0.19
+ *      multiply(out, sparse, false, W, false);
+ */
+template <typename T>
+class SparseMatrix {
+public:
+    /** One of the two formats, the rows of the matrix or the rows of its transpose. */
+    struct Compressed {
+        std::vector<int> start, index; // start has one more element than there are rows
+        std::vector<T> values;         // index and values may be longer than start.back()
+    };
+
+private:
+    size_t m_rows = 0, m_cols = 0;
+    Compressed m_csr, m_transpose;
+
+    /** Builds the transpose from the rows, a counting sort of the values by column. */
+    void transposeRows() {
+        const int nonzeros = nonZeros(), *rows_start = m_csr.start.data(), *cols = m_csr.index.data();
+        const T *values = m_csr.values.data();
+        m_transpose.start.assign(m_cols + 1, 0);
+        m_transpose.index.resize(nonzeros);
+        m_transpose.values.resize(nonzeros);
+        int *start = m_transpose.start.data(), *index = m_transpose.index.data();
+        T *transposed = m_transpose.values.data();
+        for (int k = 0; k < nonzeros; ++k)
+            ++start[cols[k] + 1];
+        for (size_t j = 0; j < m_cols; ++j)
+            start[j + 1] += start[j];
+        // start[j] is the next free slot of column j while filling, then shifted back
+        for (size_t i = 0; i < m_rows; ++i)
+            for (int k = rows_start[i]; k < rows_start[i + 1]; ++k) {
+                int slot = start[cols[k]]++;
+                index[slot] = i;
+                transposed[slot] = values[k];
+            }
+        for (size_t j = m_cols; j > 0; --j)
+            start[j] = start[j - 1];
+        start[0] = 0;
+    }
+
+public:
+    SparseMatrix() = default;
+    explicit SparseMatrix(const Matrix<T> &m) { assign(m); }
+
+    /** Stores the non-zeros of the dense matrix m. */
+    void assign(const Matrix<T> &m) {
+        m_rows = m.rows();
+        m_cols = m.cols();
+        m_csr.start.resize(m_rows + 1);
+        // room for a dense matrix, left at that size since shrinking it would have it
+        // cleared when it grows back for the next batch
+        if (m_csr.index.size() < m_rows * m_cols) {
+            m_csr.index.resize(m_rows * m_cols);
+            m_csr.values.resize(m_rows * m_cols);
+        }
+        // a group of values is compared at once into a bit mask, then only its set bits
+        // are visited, so the zeros cost neither a branch nor a store each
+        constexpr size_t group = 16;
+        int *index = m_csr.index.data(), n = 0;
+        T *values = m_csr.values.data();
+        m_csr.start[0] = 0;
+        for (size_t i = 0; i < m_rows; ++i) {
+            const T *row = m.begin(i);
+            for (size_t j = 0; j < m_cols; j += group) {
+                const size_t size = std::min(group, m_cols - j);
+                unsigned mask = 0;
+                for (size_t k = 0; k < size; ++k)
+                    mask |= unsigned(row[j + k] != T()) << k;
+                for (; mask; mask &= mask - 1) {
+                    int k = j + __builtin_ctz(mask);
+                    index[n] = k;
+                    values[n++] = row[k];
+                }
+            }
+            m_csr.start[i + 1] = n;
+        }
+        transposeRows();
+    }
+
+    /** Stores the rows [first, last) of the sparse matrix m. */
+    void assign(const SparseMatrix &m, size_t first, size_t last) {
+        if (first > last || last > m.rows())
+            throw std::out_of_range("SparseMatrix::assign() - Rows out of range");
+        const Compressed &a = m.m_csr;
+        m_rows = last - first;
+        m_cols = m.cols();
+        m_csr.start.resize(m_rows + 1);
+        for (size_t i = 0; i <= m_rows; ++i)
+            m_csr.start[i] = a.start[first + i] - a.start[first];
+        m_csr.index.assign(a.index.begin() + a.start[first], a.index.begin() + a.start[last]);
+        m_csr.values.assign(a.values.begin() + a.start[first], a.values.begin() + a.start[last]);
+        transposeRows();
+    }
+
+    constexpr size_t rows() const { return m_rows; }
+    constexpr size_t cols() const { return m_cols; }
+    size_t nonZeros() const { return m_csr.start.empty() ? 0 : m_csr.start.back(); }
+    double density() const { return m_rows && m_cols ? double(nonZeros()) / (m_rows * m_cols) : 0; }
+
+    /** The matrix, or its transpose, in CSR format. */
+    const Compressed& compressed(bool transpose = false) const { return transpose ? m_transpose : m_csr; }
+
+    Matrix<T> toMatrix() const {
+        Matrix<T> m(m_rows, m_cols);
+        for (size_t i = 0; i < m_rows; ++i)
+            for (int k = m_csr.start[i]; k < m_csr.start[i + 1]; ++k)
+                m(i, m_csr.index[k]) = m_csr.values[k];
+        return m;
+    }
+};
+
+/**
+ * c = op(a) * b for a sparse a, where op transposes a if trans_a is set, like multiply
+ * in Matrix.cpp. Every row of c is a sum of the rows of b picked by the non-zeros of
+ * the row of op(a), computed a block of columns at a time in SIMD registers, so c is
+ * written once and b only read where a is not zero. The epilogue is run on every
+ * finished row of c. b is a Matrix or a MatrixView, and cannot be transposed.
+ */
+template <typename T, typename B, typename Epilogue = typename Gemm<T>::NoEpilogue,
+          typename = typename std::enable_if<is_dense<B>::value>::type>
+void multiply(Matrix<T> &c, const SparseMatrix<T> &a, bool trans_a, const B &b, bool trans_b, Epilogue epilogue = Epilogue()) {
+    if (trans_b)
+        throw std::invalid_argument("SparseMatrix::multiplication - Transposed right operand is not supported");
+    const size_t M = trans_a ? a.cols() : a.rows(), K = trans_a ? a.rows() : a.cols(), N = b.cols();
+    if (K != b.rows())
+        throw std::invalid_argument("SparseMatrix::multiplication - Not correct dimensions");
+    NN_PROFILE_SCOPE("sparse multiply");
+    NN_PROFILE_FLOPS(2.0 * a.nonZeros() * N);
+    c.resize(M, N);
+
+    using S = Simd<T>;
+    constexpr size_t R = 4, block = R * S::width; // registers, and columns, per block
+    const auto &csr = a.compressed(trans_a);
+    for (size_t i = 0; i < M; ++i) {
+        const int first = csr.start[i], last = csr.start[i + 1];
+        T *out = c.begin(i);
+        size_t j = 0;
+        for (; j + block <= N; j += block) {
+            typename S::reg acc[R];
+            for (size_t r = 0; r < R; ++r)
+                acc[r] = S::zero();
+            for (int k = first; k < last; ++k) {
+                const typename S::reg v = S::set1(csr.values[k]);
+                const T *row = b.begin(csr.index[k]) + j;
+                for (size_t r = 0; r < R; ++r)
+                    acc[r] = S::fmadd(v, S::load(row + r * S::width), acc[r]);
+            }
+            for (size_t r = 0; r < R; ++r)
+                S::store(out + j + r * S::width, acc[r]);
+        }
+        // the last columns, fewer than a block
+        std::fill(out + j, out + N, T());
+        for (int k = first; k < last && j < N; ++k) {
+            const T v = csr.values[k], *row = b.begin(csr.index[k]);
+            for (size_t jj = j; jj < N; ++jj)
+                out[jj] += v * row[jj];
+        }
+        epilogue(out, 0, N);
+    }
+}
+
+#endif /* SPARSEMATRIX_H */
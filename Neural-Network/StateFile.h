@@ -0,0 +1,180 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+#include "Matrix.h"
+
+/**
+ * Static class to save and load matrices in a compact binary format,
+ * used for the state of the neural network.
+ *
+ * Layout of a file, in the byte order of the machine (little-endian on x86):
+ *
+ *      Header     magic "NNSTATE\0", version, dtype (bytes per scalar), number of blocks,
+ *                 size of the metadata, FNV-1a 64-bit checksum of all block data and metadata
+ *      Table      rows, cols and byte offset of every block
+ *      Metadata   optional free-form text, e.g the position of training in a checkpoint
+ *      Blocks     raw row-major scalars of every matrix, each starting at a
+ *                 multiple of 64 bytes from the start of the file
+ *
+ * Loading maps the file (see MappedFile.h) and copies the blocks straight into
+ * the matrices, nothing is parsed.
+ *
+ * Example:
+ *
+ *      StateFile::Write<double>("net.state", {&W1, &W2});
+ *      StateFile::Read<double>("net.state", {&W1, &W2}); // throws if dims, type or checksum do not match
+ *      StateFile::Metadata("net.state");                 // "" unless Write was given some
+ */
+class StateFile {
+    static constexpr char magic[8] = {'N', 'N', 'S', 'T', 'A', 'T', 'E', '\0'};
+    static const uint32_t version = 1;
+    static const size_t alignment = 64;
+
+    struct Header {
+        char magic[8];
+        uint32_t version, dtype, num_blocks, metadata_size;
+        uint64_t checksum;
+    };
+    struct Block { uint64_t rows, cols, offset; };
+
+    static uint64_t fnv1a(const unsigned char *p, size_t size, uint64_t hash = 14695981039346656037ull) {
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ p[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    static size_t align(size_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+    StateFile() {/* To prevent instantiation */}
+
+public:
+    /** Returns true if the file at file_path starts with the magic of the binary format. */
+    static bool IsStateFile(const std::string &file_path) {
+        std::ifstream file(file_path, std::ios::binary);
+        char buf[sizeof(magic)] = {};
+        file.read(buf, sizeof(buf));
+        return file && std::memcmp(buf, magic, sizeof(magic)) == 0;
+    }
+
+    /** Returns the number of blocks, i.e matrices, stored in the state file at file_path. */
+    static size_t NumBlocks(const std::string &file_path) {
+        std::ifstream file(file_path, std::ios::binary);
+        Header header = {};
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!file || std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("StateFile::NumBlocks() - Not a state file: " + file_path);
+        return header.num_blocks;
+    }
+
+    /** Returns the metadata stored in the state file at file_path, without verifying the checksum. */
+    static std::string Metadata(const std::string &file_path) {
+        MappedFile file(file_path);
+        Header header;
+        if (file.size() < sizeof(Header) || std::memcmp(file.data(), magic, sizeof(magic)) != 0)
+            throw std::runtime_error("StateFile::Metadata() - Not a state file: " + file_path);
+        std::memcpy(&header, file.data(), sizeof(header));
+        size_t offset = sizeof(Header) + header.num_blocks * sizeof(Block);
+        if (offset + header.metadata_size > file.size())
+            throw std::runtime_error("StateFile::Metadata() - File is truncated: " + file_path);
+        return std::string(reinterpret_cast<const char*>(file.data()) + offset, header.metadata_size);
+    }
+
+    /**
+     * Writes the matrices and metadata to file_path. The file is written to file_path + ".tmp"
+     * and then renamed over file_path, so a program killed while writing leaves the previous
+     * file intact, never a truncated one.
+     */
+    template <typename T>
+    static void Write(const std::string &file_path, const std::vector<const Matrix<T>*> &blocks, const std::string &metadata = "") {
+        Header header = {};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.dtype = sizeof(T);
+        header.num_blocks = blocks.size();
+        header.metadata_size = metadata.size();
+
+        std::vector<Block> table;
+        size_t offset = align(sizeof(Header) + blocks.size() * sizeof(Block) + metadata.size());
+        uint64_t checksum = fnv1a(nullptr, 0);
+        for (auto m : blocks) {
+            table.push_back({m->rows(), m->cols(), offset});
+            size_t bytes = m->rows() * m->cols() * sizeof(T);
+            checksum = fnv1a(reinterpret_cast<const unsigned char*>(m->begin()), bytes, checksum);
+            offset = align(offset + bytes);
+        }
+        header.checksum = fnv1a(reinterpret_cast<const unsigned char*>(metadata.data()), metadata.size(), checksum);
+
+        std::string tmp_path = file_path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                throw std::runtime_error("StateFile::Write() - Unable to open " + tmp_path);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Block));
+            file.write(metadata.data(), metadata.size());
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                const char zeros[alignment] = {};
+                file.write(zeros, table[i].offset - file.tellp());
+                file.write(reinterpret_cast<const char*>(blocks[i]->begin()), blocks[i]->rows() * blocks[i]->cols() * sizeof(T));
+            }
+            file.close();
+            if (!file) {
+                std::remove(tmp_path.c_str());
+                throw std::runtime_error("StateFile::Write() - Error writing " + tmp_path);
+            }
+        }
+        if (std::rename(tmp_path.c_str(), file_path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("StateFile::Write() - Unable to rename " + tmp_path + " to " + file_path);
+        }
+    }
+
+    /**
+     * Reads the blocks of the file into the given matrices. Throws if the file is not a
+     * valid state file, or if its scalar type, number of blocks or dimensions do not
+     * match the matrices. The matrices are only written once the whole file is verified.
+     */
+    template <typename T>
+    static void Read(const std::string &file_path, const std::vector<Matrix<T>*> &blocks) {
+        MappedFile file(file_path);
+        const unsigned char *p = file.data();
+        Header header;
+        if (file.size() < sizeof(Header) || std::memcmp(p, magic, sizeof(magic)) != 0)
+            throw std::runtime_error("StateFile::Read() - Not a state file: " + file_path);
+        std::memcpy(&header, p, sizeof(header));
+        if (header.version != version)
+            throw std::runtime_error("StateFile::Read() - Unsupported version: " + file_path);
+        if (header.dtype != sizeof(T) || header.num_blocks != blocks.size())
+            throw std::runtime_error("StateFile::Read() - File does not match network");
+        if (file.size() < sizeof(Header) + blocks.size() * sizeof(Block) + header.metadata_size)
+            throw std::runtime_error("StateFile::Read() - File is truncated: " + file_path);
+
+        std::vector<Block> table(blocks.size());
+        std::memcpy(table.data(), p + sizeof(Header), table.size() * sizeof(Block));
+        uint64_t checksum = fnv1a(nullptr, 0);
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (table[i].rows != blocks[i]->rows() || table[i].cols != blocks[i]->cols())
+                throw std::runtime_error("StateFile::Read() - File does not match network");
+            size_t bytes = table[i].rows * table[i].cols * sizeof(T);
+            if (table[i].offset + bytes > file.size())
+                throw std::runtime_error("StateFile::Read() - File is truncated: " + file_path);
+            checksum = fnv1a(p + table[i].offset, bytes, checksum);
+        }
+        checksum = fnv1a(p + sizeof(Header) + blocks.size() * sizeof(Block), header.metadata_size, checksum);
+        if (checksum != header.checksum)
+            throw std::runtime_error("StateFile::Read() - Checksum mismatch: " + file_path);
+
+        for (size_t i = 0; i < blocks.size(); ++i)
+            std::memcpy(blocks[i]->begin(), p + table[i].offset, table[i].rows * table[i].cols * sizeof(T));
+    }
+};
+
+#endif /* STATEFILE_H */
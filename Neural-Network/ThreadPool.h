@@ -0,0 +1,116 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Fixed size pool of worker threads for fork-join parallelism.
+ * The calling thread takes part in the work, so a pool of size N
+ * starts N - 1 threads and a pool of size 1 runs everything inline.
+ *
+ * parallelFor does not allocate, the job is passed to the workers as a
+ * function pointer and a pointer to the callable on the caller's stack.
+ *
+ * Example:
+ *
+ *      ThreadPool pool(4);
+ *      pool.parallelFor(100, [&](int i){ v[i] = f(i); }); // returns when all 100 are done
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv, done_cv;
+
+    // the current job, guarded by mutex except for next_index
+    void (*job)(void*, int) = nullptr;
+    void *job_ctx = nullptr;
+    int job_size = 0, pending = 0;
+    long generation = 0;
+    bool stop = false;
+    std::atomic<int> next_index{0};
+
+    void runJob(void (*f)(void*, int), void *ctx, int n) {
+        for (int i = next_index++; i < n; i = next_index++)
+            f(ctx, i);
+    }
+
+    void workerLoop() {
+        long seen = 0;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [&]{ return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+            auto f = job; auto ctx = job_ctx; int n = job_size;
+            lock.unlock();
+
+            runJob(f, ctx, n);
+
+            lock.lock();
+            if (--pending == 0)
+                done_cv.notify_one();
+        }
+    }
+
+public:
+    explicit ThreadPool(int num_threads) {
+        if (num_threads < 1)
+            throw std::invalid_argument("ThreadPool::Constructor() - Need at least one thread");
+        for (int i = 1; i < num_threads; ++i)
+            workers.emplace_back([this]{ workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        work_cv.notify_all();
+        std::for_each(workers.begin(), workers.end(), [](std::thread &t){ t.join(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    void operator=(const ThreadPool&) = delete;
+
+    /** Number of threads doing work, including the calling thread. */
+    int size() const { return workers.size() + 1; }
+
+    /**
+     * Calls f(i) for every i in [0, n), spread over the threads of the pool,
+     * and returns once all calls have finished. Not reentrant.
+     */
+    template <typename F>
+    void parallelFor(int n, F &&f) {
+        auto call = [](void *ctx, int i){ (*static_cast<typename std::remove_reference<F>::type*>(ctx))(i); };
+        if (workers.empty() || n < 2) {
+            for (int i = 0; i < n; ++i) f(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = call;
+            job_ctx = const_cast<void*>(static_cast<const void*>(&f));
+            job_size = n;
+            pending = workers.size();
+            next_index = 0;
+            ++generation;
+        }
+        work_cv.notify_all();
+        runJob(call, job_ctx, n);
+
+        // every worker checks in, even the ones that found no indices left, so none
+        // of them can pick up a stale job once the next one starts
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]{ return pending == 0; });
+    }
+};
+
+#endif /* THREADPOOL_H */
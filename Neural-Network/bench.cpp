@@ -0,0 +1,959 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <thread>
+#include <vector>
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "MNIST.h"
+#include "BatchLoader.h"
+#include "FastMath.h"
+#include "FixedMatrix.h"
+#include "QuantizedNetwork.h"
+#include "HogwildTrainer.h"
+#include "Optimizer.h"
+#include "SparseMatrix.h"
+#include "Random.h"
+#include "AllocationCounter.h"
+
+/* Benchmark Parameters */
+const double min_seconds = 0.25;
+const double default_tolerance = 10; // percent a metric may get worse before --compare fails
+/* Benchmark Parameters */
+
+/**
+ * Machine-readable results. Every benchmark records its numbers next to printing them,
+ * --json writes them to a file and --compare checks them against an earlier file:
+ *
+ *      ./bench.out --json bench.json                  // all sections
+ *      ./bench.out gemm --compare baseline.json       // exits with 1 if a metric regressed
+ */
+struct Metric {
+    std::string name, unit;
+    double value;
+    bool higher_is_better;
+};
+std::vector<Metric> metrics;
+
+void record(const std::string &name, double value, const std::string &unit, bool higher_is_better = true) {
+    metrics.push_back({name, unit, value, higher_is_better});
+}
+
+void writeJson(const std::string &file_path) {
+    std::ofstream file(file_path);
+    file.precision(10);
+    file << "{\n  \"metrics\": [\n";
+    for (size_t i = 0; i < metrics.size(); ++i) {
+        const Metric &m = metrics[i];
+        file << "    {\"name\": \"" << m.name << "\", \"value\": " << m.value << ", \"unit\": \"" << m.unit
+             << "\", \"higher_is_better\": " << (m.higher_is_better ? "true" : "false") << "}"
+             << (i + 1 < metrics.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n}\n";
+    if (!file)
+        throw std::runtime_error("writeJson() - Unable to write " + file_path);
+}
+
+/** Reads the metrics of a file written by writeJson, one metric per line. */
+std::map<std::string, double> readJson(const std::string &file_path) {
+    std::ifstream file(file_path);
+    if (!file.is_open())
+        throw std::runtime_error("readJson() - Unable to open " + file_path);
+    std::map<std::string, double> res;
+    for (std::string line; std::getline(file, line); ) {
+        size_t name = line.find("\"name\": \""), value = line.find("\"value\": ");
+        if (name == std::string::npos || value == std::string::npos)
+            continue;
+        name += std::strlen("\"name\": \"");
+        res[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(value + std::strlen("\"value\": ")));
+    }
+    return res;
+}
+
+/**
+ * Prints every metric that got more than tolerance percent worse than in the baseline.
+ * Returns the number of regressions.
+ */
+int compare(const std::string &baseline_path, double tolerance) {
+    auto baseline = readJson(baseline_path);
+    int regressions = 0, compared = 0;
+    for (const Metric &m : metrics) {
+        auto it = baseline.find(m.name);
+        if (it == baseline.end())
+            continue;
+        ++compared;
+        double base = it->second;
+        double change = base == 0 ? (m.value == 0 ? 0 : 100) : 100 * (m.value - base) / std::abs(base);
+        double worse = m.higher_is_better ? -change : change;
+        if (worse > tolerance) {
+            ++regressions;
+            std::cout << "> REGRESSION " << m.name << ": " << base << " -> " << m.value << " " << m.unit
+                      << " (" << std::showpos << change << std::noshowpos << "%)\n";
+        }
+    }
+    std::cout << "> Compared " << compared << " metrics against " << baseline_path << ", "
+              << regressions << " regressed by more than " << tolerance << "%\n";
+    return regressions;
+}
+
+/** Runs f repeatedly for at least min_seconds of wall time and returns the average seconds per call. */
+template<typename F>
+double secondsPerCall(F f) {
+    using clock = std::chrono::steady_clock;
+    f(); // warm up caches and lazily allocated buffers
+    int calls = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed(0);
+    while (elapsed.count() < min_seconds) {
+        f();
+        ++calls;
+        elapsed = clock::now() - start;
+    }
+    return elapsed.count() / calls;
+}
+
+template<typename T>
+double maxError(const Matrix<T> &a, const Matrix<T> &b) {
+    double max_err = 0;
+    for (auto x = a.begin(), y = b.begin(); x != a.end(); ++x, ++y)
+        max_err = std::max<double>(max_err, std::abs(*x - *y));
+    return max_err;
+}
+
+/** The i-j-k kernel the Matrix class used before Gemm, kept as a reference point. */
+template<typename T>
+Matrix<T> naiveMultiply(const Matrix<T> &a, const Matrix<T> &b) {
+    Matrix<T> c(a.rows(), b.cols());
+    for (size_t i = 0; i < c.rows(); ++i) {
+        for (size_t j = 0; j < c.cols(); ++j) {
+            T tmp = T();
+            for (size_t k = 0; k < a.cols(); ++k)
+                tmp += a(i,k) * b(k,j);
+            c(i,j) = tmp;
+        }
+    }
+    return c;
+}
+
+template<typename T>
+void benchGemm(const std::string &type, int M, int K, int N) {
+    Matrix<T> a(M, K), b(K, N);
+    a.randomize();
+    b.randomize();
+
+    double max_err = maxError(naiveMultiply(a, b), a * b);
+
+    double flop = 2.0 * M * N * K;
+    double naive   = flop / secondsPerCall([&]{ naiveMultiply(a, b); }) * 1e-9;
+    double blocked = flop / secondsPerCall([&]{ a * b; }) * 1e-9;
+    std::cout << "> GEMM " << std::setw(6) << type << " "
+              << std::setw(4) << M << "x" << std::setw(4) << K << " * "
+              << std::setw(4) << K << "x" << std::setw(4) << N << ": "
+              << "naive " << std::setw(7) << naive << " GFLOP/s | "
+              << "blocked " << std::setw(7) << blocked << " GFLOP/s | "
+              << "speedup " << std::setw(6) << blocked / naive << "x | "
+              << "max error " << std::scientific << max_err << std::fixed << "\n";
+    record("gemm/" + type + "/" + std::to_string(M) + "x" + std::to_string(K) + "x" + std::to_string(N), blocked, "GFLOP/s");
+}
+
+void gemm() {
+    const int shapes[][3] = {
+        {120, 784, 20},  // forward, data * W1
+        {120,  20, 10},  // forward, A2 * W2
+        {784, 120, 20},  // backward, data^T * delta2
+        {120,  10, 20},  // backward, delta3 * W2^T
+        {512, 512, 512}, // square reference
+    };
+    for (auto &s : shapes) benchGemm<double>("double", s[0], s[1], s[2]);
+    for (auto &s : shapes) benchGemm<float>("float",   s[0], s[1], s[2]);
+}
+
+template<typename T, size_t K, size_t N>
+void benchFixed(const std::string &type, int M) {
+    Matrix<T> a(M, K), b(K, N), c, c_fixed;
+    a.randomize();
+    b.randomize();
+    FixedMatrix<T, K, N> fixed(b);
+    multiply(c, a, false, b, false);
+    multiply(c_fixed, a, fixed);
+
+    double flop = 2.0 * M * N * K;
+    double dynamic = flop / secondsPerCall([&]{ multiply(c, a, false, b, false); }) * 1e-9;
+    double fixed_shape = flop / secondsPerCall([&]{ multiply(c_fixed, a, fixed); }) * 1e-9;
+    std::string shape = std::to_string(M) + "x" + std::to_string(K) + "x" + std::to_string(N);
+    std::cout << "> Fixed " << std::setw(6) << type << " "
+              << std::setw(4) << M << "x" << std::setw(4) << K << " * "
+              << std::setw(4) << K << "x" << std::setw(4) << N << ": "
+              << "Matrix " << std::setw(7) << dynamic << " GFLOP/s | "
+              << "FixedMatrix " << std::setw(7) << fixed_shape << " GFLOP/s | "
+              << "speedup " << std::setw(6) << fixed_shape / dynamic << "x | "
+              << "max error " << std::scientific << maxError(c, c_fixed) << std::fixed << "\n";
+    record("fixed/" + type + "/" + shape, fixed_shape, "GFLOP/s");
+}
+
+/** Output layers of the networks of main.cpp and bench, as a batch and as a single image. */
+template<typename T>
+void benchFixedShapes(const std::string &type) {
+    for (int M : {1, 120}) {
+        benchFixed<T, 20, 10>(type, M);
+        benchFixed<T, 64, 10>(type, M);
+        benchFixed<T, 128, 10>(type, M);
+    }
+}
+
+/** Evaluation of a whole 784-20-10 network, with its output layer fixed as main.cpp does and without. */
+void benchFixedLayer(int rows) {
+    Matrix<double> data(rows, 784);
+    data.randomize();
+    NeuralNetwork<double> NN(784, 20, 10, 0.1), fixed(784, 20, 10, 0.1);
+    fixed.fixLayer<20, 10>(1);
+    NeuralNetwork<double>::Workspace ws;
+    double t = secondsPerCall([&]{ NN.evaluate(data, ws); });
+    double t_fixed = secondsPerCall([&]{ fixed.evaluate(data, ws); });
+    std::cout << "> 784-20-10 evaluate " << std::setw(4) << rows << " rows: "
+              << "Matrix " << std::setw(8) << t * 1e6 << " us | "
+              << "fixLayer " << std::setw(8) << t_fixed * 1e6 << " us | "
+              << "speedup " << std::setw(6) << t / t_fixed << "x\n";
+    record("fixed/evaluate_" + std::to_string(rows), t_fixed * 1e6, "us", false);
+}
+
+void fixed() {
+    benchFixedShapes<double>("double");
+    benchFixedShapes<float>("float");
+    benchFixedLayer(1);
+    benchFixedLayer(120);
+}
+
+void benchTransposeMulti(const std::string &name, const Matrix<double> &a, const Matrix<double> &b, bool trans_a) {
+    auto copied = [&]{ return trans_a ? a.transpose() * b : a * b.transpose(); };
+    auto fused  = [&]{ return trans_a ? a.transpose_view() * b : a * b.transpose_view(); };
+    double err = maxError(copied(), fused());
+    double t_copied = secondsPerCall(copied), t_fused = secondsPerCall(fused);
+    std::cout << "> " << std::setw(8) << name << ": "
+              << "transpose() copy " << std::setw(8) << t_copied * 1e6 << " us | "
+              << "transpose_view() " << std::setw(8) << t_fused * 1e6 << " us | "
+              << "speedup " << std::setw(6) << t_copied / t_fused << "x | "
+              << "max error " << std::scientific << err << std::fixed << "\n";
+    record("transpose/" + name, t_fused * 1e6, "us", false);
+}
+
+void transpose() {
+    Matrix<double> data(120, 784), A2(120, 20), delta2(120, 20), delta3(120, 10), W2(20, 10);
+    for (auto m : {&data, &A2, &delta2, &delta3, &W2}) m->randomize();
+    benchTransposeMulti("A2^T_d3",   A2,     delta3, true);  // d_W2
+    benchTransposeMulti("d3_W2^T",   delta3, W2,     false); // delta2
+    benchTransposeMulti("X^T_d2",    data,   delta2, true);  // d_W1
+}
+
+/** Random batch of MNIST shape, 784 inputs and one-hot labels over 10 classes. */
+void randomBatch(Matrix<double> &data, Matrix<double> &labels) {
+    data.randomize();
+    labels.reset();
+    for (size_t i = 0; i < labels.rows(); ++i)
+        labels(i, rand() % labels.cols()) = 1;
+}
+
+void allocations() {
+    const int batch_size = 120;
+    Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+    randomBatch(data, labels);
+    NeuralNetwork<double> NN(784, 20, 10, 0.2), parallel_NN(784, 20, 10, 0.2, 4);
+    NeuralNetwork<double>::Workspace ws;
+    double train = allocationsPerCall([&]{ NN.train(data, labels); });
+    double parallel_train = allocationsPerCall([&]{ parallel_NN.train(data, labels); });
+    double evaluate = allocationsPerCall([&]{ NN.evaluate(data); });
+    double evaluate_ws = allocationsPerCall([&]{ NN.evaluate(data, ws); });
+    std::cout << "> Allocations per train step:                   " << train << "\n";
+    std::cout << "> Allocations per train step, 4 threads:        " << parallel_train << "\n";
+    std::cout << "> Allocations per evaluate (" << batch_size << " rows):             " << evaluate << "\n";
+    std::cout << "> Allocations per evaluate (" << batch_size << " rows), workspace:  " << evaluate_ws << "\n";
+    record("alloc/train", train, "allocations", false);
+    record("alloc/train_4_threads", parallel_train, "allocations", false);
+    record("alloc/evaluate_workspace", evaluate_ws, "allocations", false);
+}
+
+/** Bandwidth of element-wise expressions evaluated into an existing matrix, see MatrixExpr.h. */
+template<typename F>
+void benchElementwise(const std::string &name, int operands, F f) {
+    const int rows = 1024, cols = 1024;
+    double bytes = double(operands + 1) * rows * cols * sizeof(double);
+    double gbs = bytes / secondsPerCall(f) * 1e-9;
+    std::cout << "> " << std::setw(16) << name << " " << rows << "x" << cols << ": " << std::setw(7) << gbs << " GB/s\n";
+    record("elementwise/" + name, gbs, "GB/s");
+}
+
+void elementwise() {
+    Matrix<double> a(1024, 1024), b(1024, 1024), c(1024, 1024);
+    a.randomize();
+    b.randomize();
+    benchElementwise("c=a+b",           2, [&]{ c = a + b; });
+    benchElementwise("c=2a-b",          2, [&]{ c = 2.0 * a - b; });
+    benchElementwise("c=a.*b",          2, [&]{ c = a.scalar_multi(b); });
+    benchElementwise("c+=a",            2, [&]{ c += a; });
+    benchElementwise("c=-(a-b).*c",     3, [&]{ c = -1.0 * (a - b).scalar_multi(c); });
+}
+
+/** Samples per second of one train step, single threaded, on random data. */
+void train() {
+    const std::vector<std::vector<int>> networks = {{784, 20, 10}, {784, 128, 64, 10}};
+    for (auto &sizes : networks) {
+        for (int batch_size : {32, 120}) {
+            Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+            randomBatch(data, labels);
+            NeuralNetwork<double> NN(sizes, Activation::ReLU, 0.1);
+            double t = secondsPerCall([&]{ NN.train(data, labels); });
+            std::string name;
+            for (int n : sizes) name += (name.empty() ? "" : "-") + std::to_string(n);
+            std::cout << "> Train step " << std::setw(15) << name << ", batch " << std::setw(4) << batch_size << ": "
+                      << std::setw(9) << t * 1e6 << " us | " << std::setw(10) << batch_size / t << " samples/s\n";
+            record("train/" + name + "/batch_" + std::to_string(batch_size), batch_size / t, "samples/s");
+        }
+    }
+}
+
+/** Latency and throughput of evaluate on one network at increasing batch sizes. */
+void evaluate() {
+    NeuralNetwork<double> NN({784, 128, 64, 10}, Activation::ReLU, 0.1);
+    NeuralNetwork<double>::Workspace ws;
+    for (int batch_size : {1, 32, 1024}) {
+        Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+        randomBatch(data, labels);
+        double t = secondsPerCall([&]{ NN.evaluate(data, ws); });
+        std::cout << "> Evaluate 784-128-64-10, batch " << std::setw(4) << batch_size << ": "
+                  << std::setw(9) << t * 1e6 << " us | " << std::setw(10) << batch_size / t << " samples/s\n";
+        record("evaluate/batch_" + std::to_string(batch_size) + "/latency", t * 1e6, "us", false);
+        record("evaluate/batch_" + std::to_string(batch_size), batch_size / t, "samples/s");
+    }
+
+    // whole test set: parsed and evaluated at once, against streamed from the mapped file in chunks
+    try {
+        auto test = MNIST::Open(MNIST::TestSet);
+        double whole = secondsPerCall([&]{
+            NN.percentCorrect(MNIST::ParseAll<double>(MNIST::TestData), MNIST::ParseAll<double>(MNIST::TestLabels));
+        });
+        double streamed = secondsPerCall([&]{ NN.confusionMatrix(test); });
+        std::cout << "> Evaluate test set, parsed whole: " << std::setw(9) << whole * 1e3 << " ms | streamed: "
+                  << std::setw(9) << streamed * 1e3 << " ms\n";
+        record("evaluate/test_set_streamed", test.size() / streamed, "samples/s");
+    } catch (const std::runtime_error &e) {
+        std::cout << "> Evaluate test set skipped: " << e.what() << "\n";
+    }
+}
+
+void scaling() {
+    const int batch_sizes[] = {120, 1200};
+    int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    for (int batch_size : batch_sizes) {
+        Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+        randomBatch(data, labels);
+
+        double base = 0;
+        for (int threads : thread_counts) {
+            NeuralNetwork<double> NN(784, 20, 10, 0.2, threads);
+            double samples_per_sec = batch_size / secondsPerCall([&]{ NN.train(data, labels); });
+            if (threads == 1) base = samples_per_sec;
+            std::cout << "> Train, batch " << std::setw(4) << batch_size << ", "
+                      << std::setw(3) << threads << " threads: "
+                      << std::setw(10) << samples_per_sec << " samples/s | "
+                      << "epoch (60k) " << std::setw(6) << 60000 / samples_per_sec << " s | "
+                      << "speedup " << std::setw(5) << samples_per_sec / base << "x | "
+                      << "efficiency " << std::setw(6) << 100 * samples_per_sec / base / threads << "%\n";
+            record("scaling/batch_" + std::to_string(batch_size) + "/threads_" + std::to_string(threads), samples_per_sec, "samples/s");
+        }
+    }
+}
+
+void mnist() {
+    try {
+        double open = secondsPerCall([]{ MNIST::Open(MNIST::TrainingSet); });
+        auto training = MNIST::Open(MNIST::TrainingSet);
+        Matrix<double> data, labels;
+        double batches = secondsPerCall([&]{
+            for (int first = 0; first + 120 <= training.size(); first += 120)
+                training.batch(first, 120, data, labels);
+        });
+        double parse_all = secondsPerCall([]{ MNIST::ParseAll(MNIST::TrainingData); });
+        BatchLoader loader(MNIST::Open(MNIST::TrainingSet), 120);
+        double streamed = secondsPerCall([&]{
+            for (int i = 0; i < loader.batchesPerEpoch(); ++i) loader.next();
+        });
+        // the conversion before IDXFile::Decode, one byte at a time
+        double scalar = secondsPerCall([&]{
+            data.resize(120, training.inputs());
+            for (int first = 0; first + 120 <= training.size(); first += 120) {
+                const unsigned char *pixels = training.image(first);
+                std::transform(pixels, pixels + data.rows() * data.cols(), data.begin(), [](unsigned char c){ return double(c) / 255; });
+            }
+        });
+        double simd = secondsPerCall([&]{
+            for (int first = 0; first + 120 <= training.size(); first += 120)
+                training.batchData(first, 120, data);
+        });
+        std::cout << "> MNIST open training set:             " << std::setw(10) << open * 1e6 << " us\n";
+        std::cout << "> MNIST convert epoch, batches of 120: " << std::setw(10) << batches * 1e3 << " ms\n";
+        std::cout << "> MNIST decode epoch, scalar:          " << std::setw(10) << scalar * 1e3 << " ms\n";
+        std::cout << "> MNIST decode epoch, SIMD:            " << std::setw(10) << simd * 1e3 << " ms | speedup "
+                  << std::setw(6) << scalar / simd << "x\n";
+        std::cout << "> MNIST ParseAll(TrainingData):        " << std::setw(10) << parse_all * 1e3 << " ms, "
+                  << std::thread::hardware_concurrency() << " threads\n";
+        std::cout << "> MNIST BatchLoader epoch, shuffled:    " << std::setw(10) << streamed * 1e3 << " ms\n";
+        record("mnist/open", open * 1e6, "us", false);
+        record("mnist/convert_epoch", batches * 1e3, "ms", false);
+        record("mnist/decode_scalar", scalar * 1e3, "ms", false);
+        record("mnist/decode_simd", simd * 1e3, "ms", false);
+        record("mnist/parse_all", parse_all * 1e3, "ms", false);
+        record("mnist/batch_loader_epoch", streamed * 1e3, "ms", false);
+
+        // an epoch of training with batches prepared by every core, clean and distorted
+        const int threads = std::max(1u, std::thread::hardware_concurrency());
+        const std::vector<std::pair<std::string, Augmentation>> augmentations = {
+            {"clean", Augmentation()}, {"shift", Augmentation(2)}, {"elastic", Augmentation(2, 34, 4)}
+        };
+        double clean = 0;
+        for (auto &a : augmentations) {
+            BatchLoader<float> augmented(MNIST::Open(MNIST::TrainingSet), 120, 1, {0, 0}, threads, a.second);
+            double loader = secondsPerCall([&]{
+                for (int i = 0; i < augmented.batchesPerEpoch(); ++i) augmented.next();
+            });
+            NeuralNetwork<float> NN({784, 128, 64, 10}, Activation::ReLU, 0.1);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < augmented.batchesPerEpoch(); ++i) {
+                auto &batch = augmented.next();
+                NN.train(batch.data, batch.labels);
+            }
+            double epoch = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (a.first == "clean")
+                clean = epoch;
+            std::cout << "> MNIST " << std::setw(7) << a.first << " epoch, " << threads << " loader threads: batches "
+                      << std::setw(8) << loader * 1e3 << " ms | training " << std::setw(8) << epoch * 1e3 << " ms, "
+                      << std::setw(5) << epoch / clean << "x clean\n";
+            record("mnist/augment_" + a.first + "_batches", loader * 1e3, "ms", false);
+            record("mnist/augment_" + a.first + "_train_epoch", epoch * 1e3, "ms", false);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cout << "> MNIST skipped: " << e.what() << "\n";
+    }
+}
+
+long fileSize(const std::string &file_path) {
+    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+    return file.tellg();
+}
+
+void benchState(const std::string &name, int hidden, NeuralNetwork<double>::StateFormat format) {
+    const std::string file_path = "/tmp/bench_network.state";
+    NeuralNetwork<double> NN(784, hidden, 10, 0.2);
+    double save = secondsPerCall([&]{ NN.saveState(file_path, format); });
+    double load = secondsPerCall([&]{ NN.readState(file_path); });
+    std::cout << "> State " << std::setw(6) << name << ", 784x" << std::setw(4) << hidden << "x10: "
+              << "save " << std::setw(9) << save * 1e3 << " ms | "
+              << "load " << std::setw(9) << load * 1e3 << " ms | "
+              << "size " << std::setw(9) << fileSize(file_path) / 1024.0 << " KiB\n";
+    record("state/" + name + "/" + std::to_string(hidden) + "/save", save * 1e3, "ms", false);
+    record("state/" + name + "/" + std::to_string(hidden) + "/load", load * 1e3, "ms", false);
+    std::remove(file_path.c_str());
+}
+
+void state() {
+    for (int hidden : {20, 1024}) {
+        benchState("text",   hidden, NeuralNetwork<double>::Text);
+        benchState("binary", hidden, NeuralNetwork<double>::Binary);
+    }
+}
+
+void benchMixedGemm(int M, int K, int N) {
+    Matrix<float> a(M, K), b(K, N);
+    a.randomize();
+    b.randomize();
+    Matrix<bfloat16> b16 = b;
+    double err = maxError(a * b, a * b16), flop = 2.0 * M * N * K;
+    double fp32 = flop / secondsPerCall([&]{ a * b; }) * 1e-9;
+    double bf16 = flop / secondsPerCall([&]{ a * b16; }) * 1e-9;
+    std::cout << "> GEMM " << std::setw(4) << M << "x" << std::setw(4) << K << " * "
+              << std::setw(4) << K << "x" << std::setw(4) << N << ": "
+              << "fp32 " << std::setw(7) << fp32 << " GFLOP/s | "
+              << "fp32 x bf16 " << std::setw(7) << bf16 << " GFLOP/s | "
+              << "max error " << std::scientific << err << std::fixed << "\n";
+    record("gemm/bf16/" + std::to_string(M) + "x" + std::to_string(K) + "x" + std::to_string(N), bf16, "GFLOP/s");
+}
+
+template<typename T>
+void benchPrecision(const std::string &type) {
+    using clock = std::chrono::steady_clock;
+    NeuralNetwork<T> NN(784, 20, 10, 0.2);
+    BatchLoader<T> loader(MNIST::Open(MNIST::TrainingSet), 120, 1);
+    auto test_data   = MNIST::ParseAll<T>(MNIST::TestData);
+    auto test_labels = MNIST::ParseAll<T>(MNIST::TestLabels);
+
+    auto start = clock::now();
+    for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+        auto &batch = loader.next();
+        NN.train(batch.data, batch.labels);
+    }
+    std::chrono::duration<double> epoch = clock::now() - start;
+    double evaluate = secondsPerCall([&]{ NN.evaluate(test_data); });
+    std::cout << "> NeuralNetwork<" << type << ">: "
+              << "train " << std::setw(10) << loader.batchesPerEpoch() * 120 / epoch.count() << " samples/s | "
+              << "evaluate " << std::setw(10) << test_data.rows() / evaluate << " samples/s | "
+              << "test accuracy after 1 epoch " << NN.percentCorrect(test_data, test_labels) << "%\n";
+    record("precision/" + type + "/train", loader.batchesPerEpoch() * 120 / epoch.count(), "samples/s");
+    record("precision/" + type + "/evaluate", test_data.rows() / evaluate, "samples/s");
+}
+
+/**
+ * Compares a FastMath function applied in place against the libm version on random
+ * inputs in [-20, 20]. The error is relative for exp and absolute otherwise.
+ */
+template<typename T, typename Fast, typename Libm>
+void benchFastMath(const std::string &name, Fast fast, Libm libm, bool relative) {
+    const int n = 4096;
+    std::vector<T> x(n), reference(n), result(n);
+    for (auto &t : x) t = 40 * T(rand()) / RAND_MAX - 20;
+    std::transform(x.begin(), x.end(), reference.begin(), libm);
+    result = x;
+    FastMath<T>::apply(result.data(), n, fast);
+
+    double max_err = 0;
+    for (int i = 0; i < n; ++i) {
+        double err = std::abs(double(result[i]) - double(reference[i]));
+        max_err = std::max(max_err, relative ? err / std::abs(double(reference[i])) : err);
+    }
+    double t_libm = secondsPerCall([&]{ std::transform(x.begin(), x.end(), result.begin(), libm); });
+    double t_fast = secondsPerCall([&]{ result = x; FastMath<T>::apply(result.data(), n, fast); });
+    std::cout << "> " << std::setw(14) << name << ": "
+              << "libm " << std::setw(6) << t_libm / n * 1e9 << " ns | "
+              << "SIMD " << std::setw(6) << t_fast / n * 1e9 << " ns | "
+              << "speedup " << std::setw(6) << t_libm / t_fast << "x | "
+              << "max " << (relative ? "rel" : "abs") << " error " << std::scientific << max_err << std::fixed << "\n";
+    record("activations/" + name, t_fast / n * 1e9, "ns", false);
+    record("activations/" + name + "/error", max_err, relative ? "relative" : "absolute", false);
+}
+
+template<typename T>
+void benchActivations(const std::string &type) {
+    using reg = typename Simd<T>::reg;
+    benchFastMath<T>("exp_" + type,     [](reg v){ return FastMath<T>::exp(v); },     [](T t){ return std::exp(t); }, true);
+    benchFastMath<T>("sigmoid_" + type, [](reg v){ return FastMath<T>::sigmoid(v); }, [](T t){ return 1 / (1 + std::exp(-t)); }, false);
+    benchFastMath<T>("tanh_" + type,    [](reg v){ return FastMath<T>::tanh(v); },    [](T t){ return std::tanh(t); }, false);
+}
+
+void activations() {
+    benchActivations<float>("float");
+    benchActivations<double>("double");
+}
+
+/** Percentage of rows whose largest value is at the index of the label. */
+template<typename T>
+double percentCorrect(const Matrix<T> &result, const MNIST::Dataset &set) {
+    int correct = 0;
+    for (int i = 0; i < set.size(); ++i)
+        correct += std::max_element(result.begin(i), result.end(i)) - result.begin(i) == set.label(i);
+    return 100.0 * correct / set.size();
+}
+
+template<typename T>
+void benchQuantized(const std::string &type) {
+    NeuralNetwork<T> NN({784, 128, 64, 10}, Activation::ReLU, 0.1);
+    BatchLoader<T> loader(MNIST::Open(MNIST::TrainingSet), 120, 1);
+    for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+        auto &batch = loader.next();
+        NN.train(batch.data, batch.labels);
+    }
+
+    auto test = MNIST::Open(MNIST::TestSet);
+    Matrix<T> test_data;
+    test.batchData(0, test.size(), test_data);
+    QuantizedNetwork<T> Q(NN);
+    typename NeuralNetwork<T>::Workspace ws;
+    typename QuantizedNetwork<T>::Workspace qws;
+    double accuracy = percentCorrect(NN.evaluate(test_data, ws), test);
+    double quantized_accuracy = percentCorrect(Q.evaluate(test.image(0), test.size(), qws), test);
+    double t = secondsPerCall([&]{ NN.evaluate(test_data, ws); });
+    double t_quantized = secondsPerCall([&]{ Q.evaluate(test.image(0), test.size(), qws); });
+    std::cout << "> 784-128-64-10 " << std::setw(6) << type << " vs int8: "
+              << "evaluate " << std::setw(10) << test.size() / t << " samples/s | "
+              << "int8 " << std::setw(10) << test.size() / t_quantized << " samples/s | "
+              << "speedup " << std::setw(5) << t / t_quantized << "x | "
+              << "test accuracy " << accuracy << "% -> " << quantized_accuracy << "% ("
+              << std::showpos << quantized_accuracy - accuracy << std::noshowpos << ")\n";
+    record("quantized/" + type + "/evaluate", test.size() / t, "samples/s");
+    record("quantized/" + type + "/int8", test.size() / t_quantized, "samples/s");
+    record("quantized/" + type + "/accuracy_drop", accuracy - quantized_accuracy, "%", false);
+}
+
+void quantized() {
+    try {
+        benchQuantized<double>("double");
+        benchQuantized<float>("float");
+    } catch (const std::runtime_error &e) {
+        std::cout << "> NeuralNetwork quantized skipped: " << e.what() << "\n";
+    }
+}
+
+void benchLayers(const std::string &name, const std::vector<int> &sizes, Activation::Type hidden, double rate) {
+    using clock = std::chrono::steady_clock;
+    const int epochs = 3;
+    NeuralNetwork<float> NN(sizes, hidden, rate);
+    BatchLoader<float> loader(MNIST::Open(MNIST::TrainingSet), 120, 1);
+    auto test_data   = MNIST::ParseAll<float>(MNIST::TestData);
+    auto test_labels = MNIST::ParseAll<float>(MNIST::TestLabels);
+
+    std::cout << "> " << std::setw(22) << name << ":";
+    auto start = clock::now();
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+            auto &batch = loader.next();
+            NN.train(batch.data, batch.labels);
+        }
+        std::cout << " epoch " << epoch + 1 << " " << std::setw(6) << NN.percentCorrect(test_data, test_labels) << "% |";
+    }
+    std::chrono::duration<double> elapsed = clock::now() - start;
+    std::cout << " " << std::setw(6) << elapsed.count() / epochs << " s/epoch\n";
+    record("layers/" + name, elapsed.count() / epochs, "s/epoch", false);
+}
+
+void layers() {
+    try {
+        benchLayers("sigmoid_784-20-10",     {784, 20, 10},      Activation::Sigmoid, 1.0);
+        benchLayers("relu_784-128-10",       {784, 128, 10},     Activation::ReLU,    0.1);
+        benchLayers("relu_784-128-64-10",    {784, 128, 64, 10}, Activation::ReLU,    0.1);
+    } catch (const std::runtime_error &e) {
+        std::cout << "> NeuralNetwork layers skipped: " << e.what() << "\n";
+    }
+}
+
+/** Mean cross-entropy of the network on the data, the lower the better even once every item is classified right. */
+template <typename T>
+double crossEntropy(const NeuralNetwork<T> &NN, const Matrix<T> &data, const Matrix<T> &labels) {
+    Matrix<T> result = NN.evaluate(data);
+    double sum = 0;
+    for (size_t i = 0; i < result.rows(); ++i)
+        for (size_t j = 0; j < result.cols(); ++j)
+            if (labels(i, j) == 1)
+                sum -= std::log(std::max(double(result(i, j)), 1e-30));
+    return sum / result.rows();
+}
+
+void benchOptimizer(const std::string &name, Optimizer<float>::Type type, double rate) {
+    const int epochs = 3;
+    NeuralNetwork<float> NN({784, 128, 10}, Activation::ReLU, rate);
+    NN.setOptimizer(Optimizer<float>(type));
+    BatchLoader<float> loader(MNIST::Open(MNIST::TrainingSet), 120, 1);
+    auto test_data   = MNIST::ParseAll<float>(MNIST::TestData);
+    auto test_labels = MNIST::ParseAll<float>(MNIST::TestLabels);
+
+    std::cout << "> " << std::setw(8) << name << " (rate " << std::setw(5) << std::setprecision(3) << rate << std::setprecision(2) << "):";
+    double seconds = 0;
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+            auto &batch = loader.next();
+            NN.train(batch.data, batch.labels);
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << " epoch " << epoch + 1 << " " << std::setw(6) << NN.percentCorrect(test_data, test_labels)
+                  << "% loss " << std::setprecision(4) << crossEntropy(NN, test_data, test_labels) << std::setprecision(2) << " |";
+    }
+    auto &batch = loader.next();
+    double allocs = allocationsPerCall([&]{ NN.train(batch.data, batch.labels); });
+    std::cout << " " << seconds / epochs << " s/epoch | " << allocs << " allocs/step\n";
+    record("optimizers/" + name + "/loss", crossEntropy(NN, test_data, test_labels), "", false);
+    record("optimizers/" + name, seconds / epochs, "s/epoch", false);
+}
+
+void optimizers() {
+    try {
+        benchOptimizer("sgd",      Optimizer<float>::SGD,      0.1);
+        benchOptimizer("momentum", Optimizer<float>::Momentum, 0.01);
+        benchOptimizer("nesterov", Optimizer<float>::Nesterov, 0.01);
+        benchOptimizer("adam",     Optimizer<float>::Adam,     0.001);
+    } catch (const std::runtime_error &e) {
+        std::cout << "> NeuralNetwork optimizers skipped: " << e.what() << "\n";
+    }
+}
+
+/** First layer products of a real batch, dense and sparse, and a whole training step with either. */
+template <typename T>
+void benchSparse(const std::string &type, int batch_size, int hidden) {
+    auto training = MNIST::Open(MNIST::TrainingSet);
+    Matrix<T> data, labels, W(784, hidden), delta(batch_size, hidden), dense, sparse_out;
+    training.batch(0, batch_size, data, labels);
+    W.randomize();
+    delta.randomize();
+    SparseMatrix<T> sparse;
+    double convert = secondsPerCall([&]{ sparse.assign(data); });
+
+    const std::string name = type + " " + std::to_string(batch_size) + "x784 * 784x" + std::to_string(hidden);
+    auto compare = [&](const std::string &product, const std::string &key, auto dense_call, auto sparse_call) {
+        double t_dense = secondsPerCall(dense_call), t_sparse = secondsPerCall(sparse_call);
+        dense_call();
+        Matrix<T> expected = dense;
+        sparse_call();
+        std::cout << "> Sparse " << std::setw(24) << name << " " << product << ": dense " << std::setw(8) << t_dense * 1e6
+                  << " us | sparse " << std::setw(8) << t_sparse * 1e6 << " us | speedup " << std::setw(5) << t_dense / t_sparse
+                  << "x | max error " << std::scientific << maxError(expected, sparse_out) << std::fixed << "\n";
+        record("sparse/" + type + "/batch_" + std::to_string(batch_size) + "/" + key, t_dense / t_sparse, "x");
+    };
+    std::cout << "> Sparse " << std::setw(24) << name << " density " << sparse.density() << ", building it "
+              << convert * 1e6 << " us\n";
+    compare("forward  A * W   ", "forward",
+            [&]{ multiply(dense, data, false, W, false); },
+            [&]{ multiply(sparse_out, sparse, false, W, false); });
+    compare("gradient A^T * d ", "gradient",
+            [&]{ multiply(dense, data, true, delta, false); },
+            [&]{ multiply(sparse_out, sparse, true, delta, false); });
+
+    NeuralNetwork<T> NN({784, hidden, 10}, Activation::ReLU, 0.01);
+    double t_dense = secondsPerCall([&]{ NN.train(data, labels); });
+    double t_sparse = secondsPerCall([&]{ NN.train(sparse, labels); });
+    std::cout << "> Sparse " << std::setw(24) << name << " train step       : dense " << std::setw(8) << t_dense * 1e6
+              << " us | sparse " << std::setw(8) << t_sparse * 1e6 << " us | speedup " << std::setw(5) << t_dense / t_sparse << "x\n";
+    record("sparse/" + type + "/batch_" + std::to_string(batch_size) + "/train_step", t_dense / t_sparse, "x");
+}
+
+/** An epoch of training with batches from a BatchLoader, the sparse ones built on its thread. */
+template <typename T>
+double sparseEpoch(bool sparse) {
+    NeuralNetwork<T> NN({784, 128, 64, 10}, Activation::ReLU, 0.1);
+    BatchLoader<T> loader(MNIST::Open(MNIST::TrainingSet), 120, 1, {0, 0}, 1, Augmentation(), sparse);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+        auto &batch = loader.next();
+        if (sparse)
+            NN.train(batch.sparse, batch.labels);
+        else
+            NN.train(batch.data, batch.labels);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void sparse() {
+    try {
+        for (int batch_size : {1, 120}) {
+            benchSparse<double>("double", batch_size, 128);
+            benchSparse<float>("float", batch_size, 128);
+        }
+        for (bool is_float : {false, true}) {
+            double dense = is_float ? sparseEpoch<float>(false) : sparseEpoch<double>(false);
+            double sparse = is_float ? sparseEpoch<float>(true) : sparseEpoch<double>(true);
+            std::string type = is_float ? "float" : "double";
+            std::cout << "> Sparse " << std::setw(6) << type << " epoch 784-128-64-10, batches of 120: dense " << std::setw(6) << dense
+                      << " s | sparse " << std::setw(6) << sparse << " s | speedup " << std::setw(5) << dense / sparse << "x\n";
+            record("sparse/" + type + "/epoch", dense / sparse, "x");
+        }
+    } catch (const std::runtime_error &e) {
+        std::cout << "> Sparse skipped: " << e.what() << "\n";
+    }
+}
+
+/**
+ * Mini-batches of a larger matrix passed to train as views against copies of their
+ * rows, products of a block of a matrix, and the allocations of copies of equal size.
+ */
+void views() {
+    const int rows = 2400, batch_size = 120;
+    Matrix<double> data(rows, 784), labels(rows, 10), batch, batch_labels;
+    randomBatch(data, labels);
+    NeuralNetwork<double> NN({784, 128, 64, 10}, Activation::ReLU, 0.01), parallel_NN({784, 128, 64, 10}, Activation::ReLU, 0.01, 4);
+    for (auto *net : {&NN, &parallel_NN}) {
+        const std::string name = net == &NN ? "1 thread " : "4 threads";
+        int first = 0;
+        auto next = [&]{ first = (first + batch_size) % rows; };
+        double copied = secondsPerCall([&]{
+            batch = data.row_slice(first, first + batch_size);
+            batch_labels = labels.row_slice(first, first + batch_size);
+            net->train(batch, batch_labels);
+            next();
+        });
+        double viewed = secondsPerCall([&]{
+            net->train(data.view().slice(first, first + batch_size), labels.view().slice(first, first + batch_size));
+            next();
+        });
+        std::cout << "> Views train step on rows of a " << rows << "x784 matrix, " << name << ": copied " << std::setw(8) << copied * 1e6
+                  << " us | view " << std::setw(8) << viewed * 1e6 << " us | speedup " << std::setw(5) << copied / viewed << "x\n";
+        record(std::string("views/train_step_") + (net == &NN ? "1_thread" : "4_threads"), copied / viewed, "x");
+    }
+
+    Matrix<double> a(1024, 1024), b(256, 256), c;
+    a.randomize();
+    b.randomize();
+    double copied = secondsPerCall([&]{
+        Matrix<double> block(256, 256);
+        for (int i = 0; i < 256; ++i)
+            std::copy(a.begin(384 + i) + 384, a.begin(384 + i) + 640, block.begin(i));
+        multiply(c, block, false, b, false);
+    });
+    double viewed = secondsPerCall([&]{ multiply(c, a.view().block(384, 384, 256, 256), false, b, false); });
+    std::cout << "> Views 256x256 block of a 1024x1024 matrix * 256x256: copied " << std::setw(8) << copied * 1e6
+              << " us | view " << std::setw(8) << viewed * 1e6 << " us | speedup " << std::setw(5) << copied / viewed << "x\n";
+    record("views/block_multiply", copied / viewed, "x");
+
+    Matrix<double> copy;
+    double assign = allocationsPerCall([&]{ copy = a; });
+    double aligned = 0;
+    for (int i = 0; i < 100; ++i)
+        aligned += (reinterpret_cast<uintptr_t>(Matrix<double>(i + 1, 7).begin()) % 64 == 0) / 100.0;
+    std::cout << "> Allocations per copy into a matrix of the same size: " << assign
+              << ", buffers on a cache line: " << aligned * 100 << "%\n";
+    record("views/copy_assign_allocations", assign, "allocations", false);
+}
+
+/** Values per second of a fill of n values of T, Philox against rand() and std::mt19937. */
+template <typename T>
+void benchRandom(const std::string &type) {
+    const size_t n = 1 << 20;
+    std::vector<T> values(n);
+    std::mt19937 mt(1);
+    double t_rand = secondsPerCall([&]{ for (T &t : values) t = 2 * T(rand()) / RAND_MAX - 1; });
+    double t_mt = secondsPerCall([&]{
+        std::uniform_real_distribution<T> uniform(-1, 1);
+        for (T &t : values) t = uniform(mt);
+    });
+    double t_philox = secondsPerCall([&]{ Random(1).uniform(values.data(), n, T(-1), T(1)); });
+    double t_mt_normal = secondsPerCall([&]{
+        std::normal_distribution<T> normal(0, 1);
+        for (T &t : values) t = normal(mt);
+    });
+    double t_normal = secondsPerCall([&]{ Random(1).normal(values.data(), n, T(0), T(1)); });
+    std::cout << "> Random " << std::setw(6) << type << " uniform: rand() " << std::setw(7) << n / t_rand * 1e-6
+              << " M/s | mt19937 " << std::setw(7) << n / t_mt * 1e-6 << " M/s | Philox " << std::setw(7) << n / t_philox * 1e-6
+              << " M/s | normal: mt19937 " << std::setw(7) << n / t_mt_normal * 1e-6 << " M/s | Philox " << std::setw(7)
+              << n / t_normal * 1e-6 << " M/s\n";
+    record("random/" + type + "/uniform", n / t_philox * 1e-6, "M/s");
+    record("random/" + type + "/normal", n / t_normal * 1e-6, "M/s");
+}
+
+void randomNumbers() {
+    benchRandom<double>("double");
+    benchRandom<float>("float");
+
+    std::vector<int> order(60000);
+    std::mt19937 mt(1);
+    double t_std = secondsPerCall([&]{ std::shuffle(order.begin(), order.end(), mt); });
+    double t_philox = secondsPerCall([&]{ Random(1, Random::Shuffle).shuffle(order.begin(), order.end()); });
+    std::cout << "> Random shuffle of 60000: std::shuffle with mt19937 " << std::setw(7) << t_std * 1e6
+              << " us | Philox " << std::setw(7) << t_philox * 1e6 << " us\n";
+    record("random/shuffle_60000", t_philox * 1e6, "us", false);
+
+    // the same weights for a seed whatever the number of threads generating them
+    const std::vector<int> sizes = {784, 1024, 512, 10};
+    NeuralNetwork<float> one(sizes, Activation::ReLU, 0.1, 1, 7), four(sizes, Activation::ReLU, 0.1, 4, 7);
+    bool identical = true;
+    for (int l = 0; l < one.numLayers(); ++l)
+        identical &= std::equal(one.weights(l).begin(), one.weights(l).end(), four.weights(l).begin());
+    double t_one = secondsPerCall([&]{ one.reset(); }), t_four = secondsPerCall([&]{ four.reset(); });
+    std::cout << "> Random initialization of 784-1024-512-10: 1 thread " << std::setw(7) << t_one * 1e6 << " us | 4 threads "
+              << std::setw(7) << t_four * 1e6 << " us | bit-identical " << (identical ? "yes" : "NO") << "\n";
+    record("random/init_identical", identical, "bool");
+}
+
+/** Synchronous training if threads is 0, otherwise Hogwild with that many threads. */
+void benchHogwild(int threads) {
+    const int epochs = 2, batch_size = 120;
+    const std::vector<int> sizes = {784, 128, 10};
+    NeuralNetwork<float> NN(sizes, Activation::ReLU, 0.1);
+    HogwildTrainer<float> trainer(NN, std::max(threads, 1), 1);
+    auto training = MNIST::Open(MNIST::TrainingSet);
+    auto test_data   = MNIST::ParseAll<float>(MNIST::TestData);
+    auto test_labels = MNIST::ParseAll<float>(MNIST::TestLabels);
+
+    std::string name = threads ? "hogwild_" + std::to_string(threads) : "synchronous";
+    double samples_per_second = 0;
+    std::cout << "> " << std::setw(12) << name << ":";
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+        if (threads) {
+            samples_per_second += trainer.epoch(training, batch_size) / epochs;
+        } else {
+            BatchLoader<float> loader(MNIST::Open(MNIST::TrainingSet), batch_size, epoch + 1);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < loader.batchesPerEpoch(); ++i) {
+                auto &batch = loader.next();
+                NN.train(batch.data, batch.labels);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            samples_per_second += loader.batchesPerEpoch() * batch_size / elapsed.count() / epochs;
+        }
+        std::cout << " epoch " << epoch + 1 << " " << std::setw(6) << NN.percentCorrect(test_data, test_labels) << "% |";
+    }
+    double accuracy = NN.percentCorrect(test_data, test_labels);
+    std::cout << " " << std::setw(10) << samples_per_second << " samples/s\n";
+    record("hogwild/" + name, samples_per_second, "samples/s");
+    record("hogwild/" + name + "/accuracy", accuracy, "%");
+}
+
+void hogwild() {
+    try {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        benchHogwild(0);
+        benchHogwild(1);
+        if (cores > 1)
+            benchHogwild(cores);
+        benchHogwild(2 * cores); // oversubscribed, only meant to show convergence under contention
+    } catch (const std::runtime_error &e) {
+        std::cout << "> NeuralNetwork hogwild skipped: " << e.what() << "\n";
+    }
+}
+
+void precision() {
+    benchMixedGemm(120, 784, 20);
+    benchMixedGemm(1024, 784, 512);
+    try {
+        benchPrecision<double>("double");
+        benchPrecision<float>("float");
+    } catch (const std::runtime_error &e) {
+        std::cout << "> NeuralNetwork precision skipped: " << e.what() << "\n";
+    }
+}
+
+/**
+ * Usage: ./bench.out [section] [--json file] [--compare baseline] [--tolerance percent]
+ * Runs every section if none is given.
+ */
+int main(int argc, char **argv) {
+    std::string only, json_path, baseline_path;
+    double tolerance = default_tolerance;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) json_path = argv[++i];
+        else if (arg == "--compare" && i + 1 < argc) baseline_path = argv[++i];
+        else if (arg == "--tolerance" && i + 1 < argc) tolerance = std::stod(argv[++i]);
+        else only = arg;
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    if (only.empty() || only == "gemm") gemm();
+    if (only.empty() || only == "fixed") fixed();
+    if (only.empty() || only == "transpose") transpose();
+    if (only.empty() || only == "elementwise") elementwise();
+    if (only.empty() || only == "train") train();
+    if (only.empty() || only == "evaluate") evaluate();
+    if (only.empty() || only == "alloc") allocations();
+    if (only.empty() || only == "scaling") scaling();
+    if (only.empty() || only == "mnist") mnist();
+    if (only.empty() || only == "state") state();
+    if (only.empty() || only == "precision") precision();
+    if (only.empty() || only == "layers") layers();
+    if (only.empty() || only == "activations") activations();
+    if (only.empty() || only == "quantized") quantized();
+    if (only.empty() || only == "hogwild") hogwild();
+    if (only.empty() || only == "optimizers") optimizers();
+    if (only.empty() || only == "sparse") sparse();
+    if (only.empty() || only == "views") views();
+    if (only.empty() || only == "random") randomNumbers();
+
+    if (!json_path.empty())
+        writeJson(json_path);
+    return !baseline_path.empty() && compare(baseline_path, tolerance) > 0;
+}
@@ -1,24 +1,49 @@
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
 #include "Matrix.h"
 #include "NeuralNetwork.h"
 #include "MNIST.h"
+#include "BatchLoader.h"
+#include "Checkpointer.h"
+#include "HogwildTrainer.h"
+#include "InferenceServer.h"
+#include "Profiler.h"
+#include "Random.h"
+#include "Schedule.h"
 
 /* Program Parameters */
-const int num_batches = 500, batch_size = 60000 / num_batches, hidden_neurons = 20;
-const double learn_rate = 0.2;
+const int num_batches = 500, batch_size = 60000 / num_batches;
+const std::vector<int> layer_sizes = {784, 20, 10}; // must match the state in file_path, e.g {784, 128, 64, 10} with a state saved by that network
+const Activation::Type hidden_activation = Activation::Sigmoid; // must match the state in file_path as well, ReLU trains further
+const double learn_rate = 3.0; // per batch, the cost is averaged over it, so 0.2 on the old summed cost of 120 rows was 24
+using scalar = double; // float works too and trains about 1.5x faster
+const auto optimizer = Optimizer<scalar>::SGD; // Momentum and Nesterov train well at a rate of 0.01, Adam at 0.001
+const int num_threads = std::max(1u, std::thread::hardware_concurrency());
 const std::string file_path = "../Data/network.state";
+const int serve_max_batch = 64;
+const auto serve_max_wait = std::chrono::microseconds(500);
+const std::string trace_path = "trace.json"; // written after every epoch in "make profile" builds
+const bool checkpointing = false; // writes checkpoint_path while training, and resumes from it at startup if it exists
+const std::string checkpoint_path = "../Data/checkpoint.state";
+const int checkpoint_every = 100; // batches
+const Augmentation augmentation; // none, e.g Augmentation(2, 34, 4) for shifts of up to 2 pixels and elastic distortions
+const int loader_threads = std::max(1, num_threads / 2); // preparing batches, only worth it with augmentation
+const bool sparse_input = true; // the first layer skips the blank pixels, see SparseMatrix.h
 /* Program Parameters */
 
-void example(const NeuralNetwork &NN, const Matrix<double> &data, const Matrix<double> &labels) {
-    Matrix<double> example(1, data.cols());
-    int index = rand() % data.rows();
+void example(const NeuralNetwork<scalar> &NN, const MNIST::Dataset &set, Random &random) {
+    Matrix<scalar> example;
+    int index = random.below(set.size());
+    set.batchData(index, 1, example);
     for (int i = 0; i < example.cols(); ++i) {
-        example(0, i) = data(index, i);
         std::cout << (example(0, i) == 0 ? "--" : "##");
         if ((i + 1) % 28 == 0) std::cout << "\n";
     }
 
-    Matrix<double> result = NN.evaluate(example);
+    Matrix<scalar> result = NN.evaluate(example);
     double max = result(0,0);
     int maxI = 0;
     for (int i = 1; i < result.cols(); ++i) {
@@ -29,39 +54,82 @@ void example(const NeuralNetwork &NN, const Matrix<double> &data, const Matrix<d
         }
     }
     std::cout << "> Neural Network classification: " << maxI;
-    std::cout << (labels(index, maxI) == 1 ? ", Correct! " : ", Incorrect! ") << "\n";
+    std::cout << (set.label(index) == maxI ? ", Correct! " : ", Incorrect! ") << "\n";
 }
 
-void test(const NeuralNetwork &NN, const Matrix<double> &data, const Matrix<double> &labels) {
-    std::cout << "> Percent of test set correctly identified: ";
-    std::cout << NN.percentCorrect(data, labels) << "%\n";
+void test(const NeuralNetwork<scalar> &NN, const MNIST::Dataset &set) {
+    ConfusionMatrix confusion = NN.confusionMatrix(set);
+    std::cout << "> Percent of test set correctly identified: " << confusion.percentCorrect() << "%\n";
+    confusion.print(std::cout);
 }
 
-void train(NeuralNetwork &NN, const std::vector<Matrix<double>> &data, const std::vector<Matrix<double>> &labels) {
-    std::vector<int> indexes(num_batches);
-    for (int i = 0; i < indexes.size(); ++i) indexes[i] = i;
-    std::random_shuffle(indexes.begin(), indexes.end());
+/** Runs the output layer through FixedMatrix.h if it is one of the usual ones for MNIST, see NeuralNetwork::fixLayer. */
+void fixOutputLayer(NeuralNetwork<scalar> &NN) {
+    int l = NN.numLayers() - 1;
+    if (NN.outputs() != 10)
+        return;
+    switch (NN.weights(l).rows()) {
+        case 20:  NN.fixLayer<20, 10>(l);  break;
+        case 64:  NN.fixLayer<64, 10>(l);  break;
+        case 128: NN.fixLayer<128, 10>(l); break;
+    }
+}
 
-    int percent_size = data.size() / 100, percent = 0;
-    for (int i = 0; i < data.size(); ++i) {
-        NN.train(data[ indexes[i] ], labels[ indexes[i] ]);
-        if (i % percent_size == 0)
-            std::cout << "> Training: " << ++percent << "%\r" << std::flush;
+void snapshot(const NeuralNetwork<scalar> &NN, const BatchLoader<scalar> &batches, Checkpointer<scalar> *checkpointer,
+              double best = -1, int best_epoch = -1) {
+    if (!checkpointer)
+        return;
+    auto position = batches.position();
+    checkpointer->snapshot(NN, {position.epoch, position.batch, batches.seed(), best, best_epoch});
+}
+
+/**
+ * Trains the rest of the current epoch, which is all of it unless resumed from a checkpoint,
+ * writing its progress to log and checkpoints with checkpointer unless it is null, along with
+ * the best test accuracy so far and its epoch. The checkpoint at the end of the epoch is left
+ * to the caller, which knows the accuracy of the epoch.
+ */
+void train(NeuralNetwork<scalar> &NN, BatchLoader<scalar> &batches, Checkpointer<scalar> *checkpointer, std::ostream &log,
+           double best = -1, int best_epoch = -1) {
+    const int num = batches.batchesPerEpoch();
+    for (int i = batches.position().batch; i < num; ++i) {
+        auto &batch = batches.next();
+        if (sparse_input)
+            NN.train(batch.sparse, batch.labels);
+        else
+            NN.train(batch.data, batch.labels);
+        if ((i + 1) % checkpoint_every == 0 && i + 1 < num)
+            snapshot(NN, batches, checkpointer, best, best_epoch);
+        if (i % std::max(1, num / 100) == 0)
+            log << "> Training: " << 100 * i / num << "%\r" << std::flush;
+    }
+    log << "> Training: 100%\n";
+    if (Profiler::Enabled) {
+        Profiler::Report(log);
+        Profiler::NextEpoch();
+        Profiler::WriteTrace(trace_path);
+        log << "> Trace written to " << trace_path << "\n";
     }
-    std::cout << "> Training: 100%\n";
 }
 
-void read(NeuralNetwork &NN) {
-    NN.readState(file_path);
+/** Returns true if the state was read, the network is left as it was otherwise. */
+bool read(NeuralNetwork<scalar> &NN) {
+    try {
+        NN.readState(file_path);
+    } catch (const std::exception &e) { // missing, or the state of another network
+        std::cout << "> " << e.what() << "\n";
+        return false;
+    }
     std::cout << "> Neural Network state successfully read from file!\n";
+    return true;
 }
 
-void save(const NeuralNetwork &NN) {
+void save(const NeuralNetwork<scalar> &NN) {
     NN.saveState(file_path);
     std::cout << "> Neural Network state successfully saved to file!\n";
 }
 
-void reset(NeuralNetwork &NN) {
+void reset(NeuralNetwork<scalar> &NN) {
     NN.reset();
     std::cout << "> Neural Network has been reset!\n";
 }
@@ -75,30 +143,277 @@ int userInput() {
     return std::cin.fail() ? -1 : input;
 }
 
-int main() {
-    srand(time(NULL));
+/**
+ * Inference server mode, classifies images sent over stdin, or over a Unix
+ * socket if a path is given, with the network read from file_path, or with
+ * its 8-bit copy if quantize (see QuantizedNetwork.h).
+ */
+int serve(const char *socket_path, bool quantize) {
+    NeuralNetwork<scalar> NN(layer_sizes, hidden_activation, learn_rate);
+    fixOutputLayer(NN);
+    try {
+        NN.readState(file_path);
+    } catch (const std::exception &e) {
+        std::cerr << "> " << e.what() << "\n";
+        return 1;
+    }
+    InferenceServer<scalar> server(NN, serve_max_batch, serve_max_wait, quantize);
+    if (socket_path) {
+        std::cerr << "> Serving on " << socket_path << "\n";
+        try {
+            server.serveSocket(socket_path);
+        } catch (const std::exception &e) {
+            std::cerr << "> " << e.what() << "\n";
+            return 1;
+        }
+    } else {
+        server.serve(std::cin, std::cout);
+    }
+    server.latencies().report(std::cerr);
+    return 0;
+}
+
+/** Settings of a headless run, the Program Parameters unless given as flags, see usage. */
+struct RunOptions {
+    std::vector<int> layers = layer_sizes;
+    Activation::Type activation = hidden_activation;
+    Optimizer<scalar>::Type optimizer = ::optimizer;
+    int batch_size = ::batch_size, epochs = 10, threads = num_threads;
+    double rate = learn_rate;
+    std::string schedule = "constant";
+    int patience = 0;      // epochs without a better test accuracy before stopping, 0 never stops early
+    double min_delta = 0;  // percent the accuracy must improve by to count as better
+    unsigned seed = std::random_device()();
+    std::string in_path, out_path, checkpoint;
+    bool hogwild = false;  // lock-free asynchronous SGD, see HogwildTrainer.h
+};
+
+void usage(std::ostream &os) {
+    os << "Usage: ./a.out                           interactive menu\n"
+          "       ./a.out serve [--int8] [socket]   inference server, see InferenceServer.h,\n"
+          "                                         --int8 with 8-bit weights, see QuantizedNetwork.h\n"
+          "       ./a.out train [flags]             headless training, one line of JSON per epoch on stdout\n"
+          "\n"
+          "  --layers 784,128,64,10   sizes of the layers, inputs first\n"
+          "  --activation relu        of the hidden layers: relu, sigmoid or tanh\n"
+          "  --optimizer sgd          sgd, momentum, nesterov or adam\n"
+          "  --batch 120              examples per batch\n"
+          "  --epochs 10              epochs to train, counted from the first if resumed\n"
+          "  --rate 0.1               learning rate of the first epoch\n"
+          "  --schedule constant      constant, step:factor:every, exp:factor or cosine, see Schedule.h\n"
+          "  --patience 0             stop after this many epochs without a better test accuracy, 0 never\n"
+          "  --min-delta 0            percent the test accuracy must improve by to count as better\n"
+          "  --threads N              threads of training, all cores by default\n"
+          "  --seed N                 seed of the weights, shuffling and augmentation, random by default\n"
+          "  --in file                network state to start from instead of random weights\n"
+          "  --out file               where the network of the best epoch is saved\n"
+          "  --checkpoint file        checkpoint written while training and resumed from if it exists\n"
+          "  --hogwild                lock-free training on all threads at once, plain SGD without checkpoints\n";
+}
+
+template <typename E>
+E parseName(const std::string &name, const std::vector<std::pair<std::string, E>> &names) {
+    for (auto &n : names)
+        if (n.first == name)
+            return n.second;
+    throw std::invalid_argument("parseName() - Unknown name: " + name);
+}
+
+std::vector<int> parseSizes(const std::string &list) {
+    std::vector<int> sizes;
+    std::istringstream is(list);
+    for (std::string size; std::getline(is, size, ',');)
+        sizes.push_back(std::stoi(size));
+    return sizes;
+}
+
+RunOptions parseOptions(int argc, char **argv) {
+    RunOptions o;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--hogwild") {
+            o.hogwild = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument("parseOptions() - Missing value of " + arg);
+        std::string value = argv[++i];
+        if (arg == "--layers") o.layers = parseSizes(value);
+        else if (arg == "--activation") o.activation = parseName<Activation::Type>(value,
+            {{"relu", Activation::ReLU}, {"sigmoid", Activation::Sigmoid}, {"tanh", Activation::Tanh}});
+        else if (arg == "--optimizer") o.optimizer = parseName<Optimizer<scalar>::Type>(value,
+            {{"sgd", Optimizer<scalar>::SGD}, {"momentum", Optimizer<scalar>::Momentum},
+             {"nesterov", Optimizer<scalar>::Nesterov}, {"adam", Optimizer<scalar>::Adam}});
+        else if (arg == "--batch") o.batch_size = std::stoi(value);
+        else if (arg == "--epochs") o.epochs = std::stoi(value);
+        else if (arg == "--rate") o.rate = std::stod(value);
+        else if (arg == "--schedule") o.schedule = value;
+        else if (arg == "--patience") o.patience = std::stoi(value);
+        else if (arg == "--min-delta") o.min_delta = std::stod(value);
+        else if (arg == "--threads") o.threads = std::stoi(value);
+        else if (arg == "--seed") o.seed = std::stoul(value);
+        else if (arg == "--in") o.in_path = value;
+        else if (arg == "--out") o.out_path = value;
+        else if (arg == "--checkpoint") o.checkpoint = value;
+        else throw std::invalid_argument("parseOptions() - Unknown flag " + arg);
+    }
+    if (o.batch_size < 1 || o.epochs < 1 || o.rate <= 0 || o.patience < 0 || o.threads < 1)
+        throw std::invalid_argument("parseOptions() - Invalid argument(s)");
+    LearnRateSchedule::Parse(o.schedule, o.rate, o.epochs); // throws if it is not a schedule
+    if (o.hogwild && (o.optimizer != Optimizer<scalar>::SGD || !o.checkpoint.empty()))
+        throw std::invalid_argument("parseOptions() - --hogwild trains with plain SGD and without checkpoints");
+    return o;
+}
+
+/**
+ * Headless training, for scripted runs: trains o.epochs epochs at the rates of the schedule,
+ * and prints one line of JSON per epoch on stdout with its wall time, training throughput and
+ * test accuracy, and a summary at the end. Everything else goes to stderr. Stops early once
+ * the test accuracy has not improved for o.patience epochs, the network of the best epoch is
+ * the one saved to o.out_path. With o.hogwild the epochs are trained by a HogwildTrainer
+ * on o.threads threads instead of in batches of the BatchLoader.
+ */
+int headless(const RunOptions &o) {
+    using clock = std::chrono::steady_clock;
+    auto seconds = [](clock::time_point from){ return std::chrono::duration<double>(clock::now() - from).count(); };
+    const auto run_start = clock::now();
+
+    LearnRateSchedule schedule = LearnRateSchedule::Parse(o.schedule, o.rate, o.epochs);
+    Checkpointer<scalar>::Progress progress = {0, 0, o.seed};
+    NeuralNetwork<scalar> NN(o.layers, o.activation, o.rate, o.threads, progress.seed);
+    fixOutputLayer(NN);
+    NN.setOptimizer(Optimizer<scalar>(o.optimizer));
+    if (!o.in_path.empty())
+        NN.readState(o.in_path);
+    if (!o.checkpoint.empty() && Checkpointer<scalar>::Exists(o.checkpoint)) {
+        progress = Checkpointer<scalar>::Resume(o.checkpoint, NN);
+        std::cerr << "> Resumed from checkpoint at epoch " << progress.epoch << ", batch " << progress.batch;
+        if (progress.best_epoch >= 0)
+            std::cerr << ", best test accuracy " << progress.best << "% at epoch " << progress.best_epoch;
+        std::cerr << "\n";
+    }
+    std::unique_ptr<BatchLoader<scalar>> batches;
+    std::unique_ptr<HogwildTrainer<scalar>> hogwild;
+    std::unique_ptr<MNIST::Dataset> training_set; // of the HogwildTrainer
+    if (o.hogwild) {
+        hogwild.reset(new HogwildTrainer<scalar>(NN, o.threads, progress.seed));
+        training_set.reset(new MNIST::Dataset(MNIST::Open(MNIST::TrainingSet)));
+    } else {
+        batches.reset(new BatchLoader<scalar>(MNIST::Open(MNIST::TrainingSet), o.batch_size, progress.seed,
+                                              {progress.epoch, progress.batch}, std::max(1, o.threads / 2),
+                                              augmentation, sparse_input));
+    }
+    std::unique_ptr<Checkpointer<scalar>> checkpointer;
+    if (!o.checkpoint.empty())
+        checkpointer.reset(new Checkpointer<scalar>(o.checkpoint));
+    auto test_set = MNIST::Open(MNIST::TestSet);
+
+    double best = progress.best;
+    int best_epoch = progress.best_epoch, epoch = batches ? batches->position().epoch : 0;
+    for (; epoch < o.epochs && (o.patience == 0 || best_epoch < 0 || epoch - best_epoch <= o.patience); ++epoch) {
+        NN.setLearnRate(schedule.rate(epoch));
+        long samples;
+        auto start = clock::now();
+        if (hogwild) {
+            samples = long(training_set->size() / o.batch_size) * o.batch_size;
+            hogwild->epoch(*training_set, o.batch_size);
+        } else {
+            samples = long(batches->batchesPerEpoch() - batches->position().batch) * o.batch_size;
+            train(NN, *batches, checkpointer.get(), std::cerr, best, best_epoch);
+        }
+        double train_seconds = seconds(start);
+        double accuracy = NN.confusionMatrix(test_set).percentCorrect();
+        double epoch_seconds = seconds(start);
+
+        bool improved = accuracy > best + o.min_delta;
+        if (improved) {
+            best = accuracy;
+            best_epoch = epoch;
+            if (!o.out_path.empty())
+                NN.saveState(o.out_path);
+        }
+        if (batches)
+            snapshot(NN, *batches, checkpointer.get(), best, best_epoch);
+        std::cout << "{\"epoch\": " << epoch << ", \"learn_rate\": " << NN.learnRate()
+                  << ", \"seconds\": " << epoch_seconds << ", \"train_seconds\": " << train_seconds
+                  << ", \"samples_per_second\": " << samples / train_seconds
+                  << ", \"test_accuracy\": " << accuracy << ", \"improved\": " << (improved ? "true" : "false") << "}"
+                  << std::endl;
+    }
+    std::cout << "{\"summary\": true, \"epochs\": " << epoch << ", \"best_epoch\": " << best_epoch
+              << ", \"best_test_accuracy\": " << best << ", \"stopped_early\": " << (epoch < o.epochs ? "true" : "false")
+              << ", \"seconds\": " << seconds(run_start) << "}" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "serve") {
+        bool quantize = argc > 2 && std::string(argv[2]) == "--int8";
+        return serve(argc > 2 + quantize ? argv[2 + quantize] : nullptr, quantize);
+    }
+    if (argc > 1 && std::string(argv[1]) == "train") {
+        RunOptions options;
+        try {
+            options = parseOptions(argc, argv);
+        } catch (const std::logic_error &e) {
+            std::cerr << e.what() << "\n\n";
+            usage(std::cerr);
+            return 2;
+        }
+        try {
+            return headless(options);
+        } catch (const std::exception &e) { // e.g a checkpoint or state of another network
+            std::cerr << "> " << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (argc > 1) {
+        bool help = std::string(argv[1]) == "help" || std::string(argv[1]) == "--help";
+        usage(help ? std::cout : std::cerr);
+        return help ? 0 : 2;
+    }
+
     clock_t before = clock();
     std::cout << "\n> Parsing MNIST data set.\n" << std::flush;
-    auto training_labels = MNIST::Parse(MNIST::TrainingLabels, batch_size, num_batches);
-    auto training_data   = MNIST::Parse(MNIST::TrainingData,   batch_size, num_batches);
-    auto test_labels     = MNIST::ParseAll(MNIST::TestLabels);
-    auto test_data       = MNIST::ParseAll(MNIST::TestData);
+    Checkpointer<scalar>::Progress progress = {0, 0, std::random_device()()}; // seed of everything random, see Random.h
+    NeuralNetwork<scalar> NN(layer_sizes, hidden_activation, learn_rate, num_threads, progress.seed);
+    fixOutputLayer(NN);
+    NN.setOptimizer(Optimizer<scalar>(optimizer));
+    if (checkpointing && Checkpointer<scalar>::Exists(checkpoint_path)) {
+        try {
+            progress = Checkpointer<scalar>::Resume(checkpoint_path, NN);
+            std::cout << "> Resumed from checkpoint at epoch " << progress.epoch << ", batch " << progress.batch << "\n";
+        } catch (const std::exception &e) { // e.g the checkpoint of another network, which is left as it was
+            std::cout << "> " << e.what() << "\n> Starting over instead\n";
+        }
+    }
+    auto openBatches = [&](BatchLoader<scalar>::Position start){ // prefetches in the background
+        return std::unique_ptr<BatchLoader<scalar>>(new BatchLoader<scalar>(MNIST::Open(MNIST::TrainingSet), batch_size, progress.seed,
+                                                                            start, loader_threads, augmentation, sparse_input));
+    };
+    auto batches = openBatches({progress.epoch, progress.batch});
+    std::unique_ptr<Checkpointer<scalar>> checkpointer;
+    if (checkpointing)
+        checkpointer.reset(new Checkpointer<scalar>(checkpoint_path));
+    auto test_set = MNIST::Open(MNIST::TestSet); // evaluated straight from the mapped file
+    Random examples(progress.seed);
     std::cout << "> Time: " << double(clock() - before) / CLOCKS_PER_SEC << "s\n";
 
-    NeuralNetwork NN(test_data.cols(), hidden_neurons, test_labels.cols(), learn_rate);
     while(true) {
         std::cout << "1: Example | 2: Test | 3: Train | 4: Read | 5: Reset | 6: Save | 7: Exit\n";
         std::cout << "Enter a number to choose an action: ";
 
         int input = userInput();
         before = clock();
+        // Read and Reset start over from the first batch, the position in the data was that of the old weights
         switch(input) {
-            case 1: example(NN, test_data, test_labels);       break;
-            case 2: test(NN, test_data, test_labels);          break;
-            case 3: train(NN, training_data, training_labels); break;
-            case 4: read(NN);                                  break;
-            case 5: reset(NN);                                 break;
-            case 6: save(NN);                                  break;
+            case 1: example(NN, test_set, examples);                    break;
+            case 2: test(NN, test_set);                                 break;
+            case 3: train(NN, *batches, checkpointer.get(), std::cout);
+                    snapshot(NN, *batches, checkpointer.get());         break;
+            case 4: if (read(NN)) batches = openBatches({0, 0});        break;
+            case 5: reset(NN); batches = openBatches({0, 0});           break;
+            case 6: save(NN);                                           break;
             case 7: std::cout << "> Neural Network exits.\n";
                 return 0;
             default: std::cout << "> Not a valid choice.\n";
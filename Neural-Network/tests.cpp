@@ -0,0 +1,332 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Matrix.h"
+#include "NeuralNetwork.h"
+#include "Optimizer.h"
+#include "QuantizedNetwork.h"
+#include "Random.h"
+#include "StateFile.h"
+#include "ThreadPool.h"
+#include "AllocationCounter.h"
+
+/**
+ * Checks of the numeric kernels against straightforward reference code, and of the
+ * steps that must not allocate. Needs no data set, every input is generated from a
+ * fixed seed (see Random.h), so a failure reproduces exactly.
+ *
+ *      ./tests.out              // all sections, exits with 1 if any check failed
+ *      ./tests.out gemm         // a single section
+ */
+int num_checks = 0, num_failures = 0;
+
+void check(bool ok, const std::string &what) {
+    ++num_checks;
+    if (!ok) {
+        ++num_failures;
+        std::cout << "> FAILED " << what << "\n";
+    }
+}
+
+template<typename T>
+double maxError(const Matrix<T> &a, const Matrix<T> &b) {
+    if (a.rows() != b.rows() || a.cols() != b.cols())
+        return INFINITY;
+    double max_err = 0;
+    for (auto x = a.begin(), y = b.begin(); x != a.end(); ++x, ++y)
+        max_err = std::max<double>(max_err, std::abs(*x - *y));
+    return max_err;
+}
+
+template<typename T>
+Matrix<T> naiveMultiply(const Matrix<T> &a, const Matrix<T> &b) {
+    Matrix<T> c(a.rows(), b.cols());
+    for (size_t i = 0; i < c.rows(); ++i)
+        for (size_t j = 0; j < c.cols(); ++j) {
+            double sum = 0;
+            for (size_t k = 0; k < a.cols(); ++k)
+                sum += double(a(i,k)) * b(k,j);
+            c(i,j) = sum;
+        }
+    return c;
+}
+
+/** Products and transposed products of Gemm.h against the triple loop, on shapes that leave partial tiles. */
+template<typename T>
+void gemm(const std::string &type, double tolerance) {
+    const int shapes[][3] = {{1, 1, 1}, {120, 784, 20}, {120, 20, 10}, {7, 13, 5}, {33, 65, 17}, {257, 129, 31}};
+    uint64_t stream = 0;
+    for (auto &s : shapes) {
+        Matrix<T> a(s[0], s[1]), b(s[1], s[2]), at(s[1], s[0]);
+        a.randomize(1, stream++);
+        b.randomize(1, stream++);
+        at.randomize(1, stream++);
+        std::string shape = std::to_string(s[0]) + "x" + std::to_string(s[1]) + "x" + std::to_string(s[2]);
+        Matrix<T> expected = naiveMultiply(a, b);
+        check(maxError<T>(a * b, expected) < tolerance * s[1], "gemm " + type + " " + shape);
+        check(maxError<T>(at.transpose_view() * b, naiveMultiply(at.transpose(), b)) < tolerance * s[1],
+              "gemm " + type + " transposed " + shape);
+    }
+}
+
+/** A layer fixed with NeuralNetwork::fixLayer against the same network without, before and after training. */
+void fixedLayers() {
+    const int batch_size = 120;
+    Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+    data.randomize(8, 0);
+    for (int i = 0; i < batch_size; ++i)
+        labels(i, i % 10) = 1;
+    NeuralNetwork<double> NN({784, 64, 10}, Activation::ReLU, 0.1, 1, 8), fixed({784, 64, 10}, Activation::ReLU, 0.1, 1, 8);
+    fixed.fixLayer<64, 10>(1);
+    check(maxError(NN.evaluate(data), fixed.evaluate(data)) < 1e-12, "fixed layer evaluate");
+    for (int i = 0; i < 5; ++i) {
+        NN.train(data, labels);
+        fixed.train(data, labels);
+    }
+    check(maxError(NN.evaluate(data), fixed.evaluate(data)) < 1e-12, "fixed layer evaluate after training");
+    const std::string path = "tests.state";
+    NN.saveState(path);
+    fixed.reset();
+    fixed.readState(path);
+    std::remove(path.c_str());
+    check(maxError(NN.evaluate(data), fixed.evaluate(data)) < 1e-12, "fixed layer evaluate after readState");
+
+    bool threw = false;
+    try {
+        fixed.fixLayer<20, 10>(1);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    check(threw, "fixing a layer of another shape throws");
+}
+
+/** Element-wise expressions of MatrixExpr.h against the same arithmetic written out per element. */
+void expressions() {
+    const int rows = 37, cols = 29;
+    Matrix<double> a(rows, cols), b(rows, cols), c(rows, cols), expected(rows, cols);
+    a.randomize(2, 0);
+    b.randomize(2, 1);
+    c.randomize(2, 2);
+
+    Matrix<double> sum = a + b;
+    for (int i = 0; i < rows * cols; ++i) expected.begin()[i] = a.begin()[i] + b.begin()[i];
+    check(maxError(sum, expected) == 0, "expression a+b");
+
+    Matrix<double> nested = -1.0 * (a - b).scalar_multi(c);
+    for (int i = 0; i < rows * cols; ++i) expected.begin()[i] = -1.0 * ((a.begin()[i] - b.begin()[i]) * c.begin()[i]);
+    check(maxError(nested, expected) == 0, "expression -(a-b).*c");
+
+    Matrix<double> scaled = 2.0 * a - b;
+    for (int i = 0; i < rows * cols; ++i) expected.begin()[i] = 2.0 * a.begin()[i] - b.begin()[i];
+    check(maxError(scaled, expected) == 0, "expression 2a-b");
+
+    Matrix<double> acc = c;
+    acc += a.scalar_multi(b);
+    for (int i = 0; i < rows * cols; ++i) expected.begin()[i] = c.begin()[i] + a.begin()[i] * b.begin()[i];
+    check(maxError(acc, expected) == 0, "expression c+=a.*b");
+
+    // the operands of the expression are read before the result is written
+    Matrix<double> aliased = a;
+    aliased = aliased - b;
+    for (int i = 0; i < rows * cols; ++i) expected.begin()[i] = a.begin()[i] - b.begin()[i];
+    check(maxError(aliased, expected) == 0, "expression a=a-b");
+
+    bool threw = false;
+    try {
+        Matrix<double> wrong(rows + 1, cols);
+        Matrix<double> bad = a + wrong;
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    check(threw, "expression of mismatched sizes throws");
+}
+
+/** The 8-bit copy of a network (QuantizedNetwork.h) against the network it was made from. */
+void quantized() {
+    const int rows = 64;
+    NeuralNetwork<float> NN({784, 64, 10}, Activation::ReLU, 0.1f, 1, 3);
+    std::vector<unsigned char> pixels(rows * 784);
+    Random random(3, 1);
+    for (auto &p : pixels)
+        p = random.below(4) == 0 ? random.below(256) : 0; // mostly blank, like MNIST
+    Matrix<float> data(rows, 784);
+    std::transform(pixels.begin(), pixels.end(), data.begin(), [](unsigned char c){ return c / 255.0f; });
+
+    QuantizedNetwork<float> Q(NN);
+    Matrix<float> expected = NN.evaluate(data), result = Q.evaluate(pixels.data(), rows);
+    check(result.rows() == size_t(rows) && result.cols() == 10, "quantized output size");
+    check(maxError(result, expected) < 0.02, "quantized probabilities within 0.02");
+    int agree = 0;
+    for (int i = 0; i < rows; ++i)
+        agree += std::max_element(result.begin(i), result.end(i)) - result.begin(i)
+              == std::max_element(expected.begin(i), expected.end(i)) - expected.begin(i);
+    check(agree >= rows * 9 / 10, "quantized classes agree on 90% of rows");
+}
+
+/** Round trip of StateFile.h and of the network state, and the errors a damaged file gives. */
+void state() {
+    const std::string path = "tests.state";
+    Matrix<double> a(3, 5), b(17, 1), a2(3, 5), b2(17, 1);
+    a.randomize(4, 0);
+    b.randomize(4, 1);
+    StateFile::Write<double>(path, {&a, &b}, "epoch 3");
+    StateFile::Read<double>(path, {&a2, &b2});
+    check(maxError(a, a2) == 0 && maxError(b, b2) == 0, "state file round trip");
+    check(StateFile::Metadata(path) == "epoch 3", "state file metadata");
+    check(StateFile::NumBlocks(path) == 2, "state file number of blocks");
+    check(!std::ifstream(path + ".tmp"), "state file leaves no temporary file");
+
+    bool threw = false;
+    try {
+        Matrix<double> wrong(5, 3);
+        StateFile::Read<double>(path, {&wrong, &b2});
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "state file of other dimensions throws");
+
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('x');
+    }
+    threw = false;
+    try {
+        StateFile::Read<double>(path, {&a2, &b2});
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "state file with a damaged block throws");
+
+    NeuralNetwork<double> NN({784, 20, 10}, Activation::Sigmoid, 0.1, 1, 4), read({784, 20, 10}, Activation::Sigmoid, 0.1, 1, 5);
+    for (auto format : {NeuralNetwork<double>::Binary, NeuralNetwork<double>::Text}) {
+        NN.saveState(path, format);
+        read.readState(path);
+        auto p = NN.parameters(), q = read.parameters();
+        double err = 0;
+        for (size_t i = 0; i < p.size(); ++i)
+            err = std::max(err, maxError(*p[i], *q[i]));
+        double tolerance = format == NeuralNetwork<double>::Binary ? 0 : 1e-14; // text has 15 significant digits
+        check(err <= tolerance, std::string("network state round trip, ") + (format == NeuralNetwork<double>::Binary ? "binary" : "text"));
+    }
+    std::remove(path.c_str());
+}
+
+/** A few steps of every rule of Optimizer.h against its formula, on a size that leaves a partial register. */
+template<typename T>
+void optimizers(const std::string &type) {
+    using O = Optimizer<T>;
+    const size_t n = 37;
+    const T rate = 0.01, b1 = 0.9, b2 = 0.999, eps = 1e-8;
+    std::vector<T> g(n);
+    Random(6).uniform(g.data(), n, T(-1), T(1));
+    for (auto rule : {O::SGD, O::Momentum, O::Nesterov, O::Adam}) {
+        O optimizer(rule, b1, b2, eps);
+        std::vector<T> p(n, 1), m(n), v(n);
+        std::vector<double> p_ref(n, 1), m_ref(n), v_ref(n);
+        for (int t = 1; t <= 3; ++t) {
+            optimizer.nextStep();
+            optimizer.update(rate, p.data(), g.data(), m.data(), v.data(), n);
+            for (size_t i = 0; i < n; ++i) {
+                double gi = g[i];
+                switch (rule) {
+                    case O::SGD:
+                        p_ref[i] -= rate * gi;
+                        break;
+                    case O::Momentum:
+                        m_ref[i] = b1 * m_ref[i] + gi;
+                        p_ref[i] -= rate * m_ref[i];
+                        break;
+                    case O::Nesterov:
+                        m_ref[i] = b1 * m_ref[i] + gi;
+                        p_ref[i] -= rate * (gi + b1 * m_ref[i]);
+                        break;
+                    case O::Adam:
+                        m_ref[i] = b1 * m_ref[i] + (1 - b1) * gi;
+                        v_ref[i] = b2 * v_ref[i] + (1 - b2) * gi * gi;
+                        p_ref[i] -= rate * std::sqrt(1 - std::pow(double(b2), t)) / (1 - std::pow(double(b1), t))
+                                    * m_ref[i] / (std::sqrt(v_ref[i]) + eps);
+                        break;
+                }
+            }
+        }
+        double err = 0;
+        for (size_t i = 0; i < n; ++i)
+            err = std::max(err, std::abs(p[i] - p_ref[i]));
+        check(err < (sizeof(T) == 4 ? 1e-5 : 1e-12), "optimizer " + type + " rule " + std::to_string(rule));
+        check(optimizer.steps() == 3, "optimizer " + type + " steps");
+    }
+}
+
+/** Philox4x32-10 of Random.h against its known-answer vector, and fills split over a pool against one fill. */
+void randomNumbers() {
+    // Salmon et al. 2011 (Random123 kat_vectors), key and counter zero
+    const uint32_t expected[4] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+    Random random(0, 0);
+    bool ok = true;
+    for (uint32_t word : expected)
+        ok &= random() == word;
+    check(ok, "Philox4x32-10 known answer");
+
+    ThreadPool pool(4);
+    Matrix<float> one(600, 1000), split(600, 1000);
+    Random(9, 2).uniform(one, -1.0f, 1.0f);
+    Random(9, 2).uniform(split, -1.0f, 1.0f, &pool);
+    check(maxError(one, split) == 0, "uniform fill over a pool");
+    Random(9, 3).normal(one, 0.0f, 1.0f);
+    Random(9, 3).normal(split, 0.0f, 1.0f, &pool);
+    check(maxError(one, split) == 0, "normal fill over a pool");
+}
+
+/** Training steps and evaluation into a workspace allocate nothing once warm, with a fixed layer too, see AllocationCounter.h. */
+void allocations() {
+    const int batch_size = 120;
+    Matrix<double> data(batch_size, 784), labels(batch_size, 10);
+    data.randomize(7, 0);
+    for (int i = 0; i < batch_size; ++i)
+        labels(i, i % 10) = 1;
+    for (int threads : {1, 4}) {
+        NeuralNetwork<double> NN({784, 20, 10}, Activation::Sigmoid, 0.1, threads), adam({784, 128, 64, 10}, Activation::ReLU, 0.001, threads);
+        adam.setOptimizer(Optimizer<double>(Optimizer<double>::Adam));
+        NN.fixLayer<20, 10>(1);
+        NeuralNetwork<double>::Workspace ws;
+        std::string with = " with " + std::to_string(threads) + " thread(s)";
+        check(allocationsPerCall([&]{ NN.train(data, labels); }) == 0, "train allocates" + with);
+        check(allocationsPerCall([&]{ adam.train(data, labels); }) == 0, "train with Adam allocates" + with);
+        check(allocationsPerCall([&]{ NN.evaluate(data, ws); }) == 0, "evaluate into a workspace allocates" + with);
+    }
+}
+
+/**
+ * Usage: ./tests.out [section]
+ * Runs every section if none is given.
+ */
+int main(int argc, char **argv) {
+    std::string only = argc > 1 ? argv[1] : "";
+    if (only.empty() || only == "gemm") {
+        gemm<double>("double", 1e-15);
+        gemm<float>("float", 1e-6);
+    }
+    if (only.empty() || only == "fixed") fixedLayers();
+    if (only.empty() || only == "expressions") expressions();
+    if (only.empty() || only == "quantized") quantized();
+    if (only.empty() || only == "state") state();
+    if (only.empty() || only == "optimizers") {
+        optimizers<double>("double");
+        optimizers<float>("float");
+    }
+    if (only.empty() || only == "random") randomNumbers();
+    if (only.empty() || only == "alloc") allocations();
+
+    if (num_checks == 0) {
+        std::cout << "> No section named " << only << "\n";
+        return 1;
+    }
+    std::cout << "> " << num_checks - num_failures << " of " << num_checks << " checks passed\n";
+    return num_failures > 0;
+}